@@ -0,0 +1,240 @@
+/*
+    Aho-Corasick keyword automata built as StateDiagrams.
+
+    Used by the generator tool (gen.cpp) for --keywords.
+*/
+#ifndef AHO_CORASICK_HPP
+#define AHO_CORASICK_HPP
+
+#include "dfa.hpp"
+
+#include <unordered_map>
+
+class AhoCorasick {
+    /*
+        Multi-keyword matcher: an Aho-Corasick automaton compiled like any
+        other DFA, plus the keyword ending at every state.
+
+        State s of the automaton is trie node s - 1 (q = 1 is the root).
+
+        @param CompiledDFAPtr automaton: diagram and transition table
+        @param vector<int32_t> own: own[s] = id of the keyword spelled by the
+            path to s, -1 if none
+        @param vector<int32_t> suffix: suffix[s] = nearest state on the failure
+            chain of s (excluding s) with own != -1, -1 if none
+        @param vector<string> keywords: keywords by id
+    */
+
+    CompiledDFAPtr automaton;
+    std::vector<int32_t> own;
+    std::vector<int32_t> suffix;
+    std::vector<std::string> keywords;
+
+    friend class AhoCorasickBuilder;
+
+public:
+    const CompiledDFAPtr& getAutomaton() const {
+        return automaton;
+    }
+
+    size_t size() const {
+        return keywords.size();
+    }
+
+    const std::string& keyword(uint32_t id) const {
+        return keywords[id];
+    }
+
+    int32_t acceptId(int32_t state) const {
+        /*
+            @return int32_t id: longest keyword ending in `state`, -1 if none
+        */
+
+        if(size_t(state) >= own.size()) return -1;
+        if(own[state] != -1) return own[state];
+        return suffix[state] == -1 ? -1 : own[suffix[state]];
+    }
+
+    template<class Callback>
+    void findAll(Cursor& cursor, const char* data, size_t length, Callback match) const {
+        /*
+            Feed data to the cursor and call match(keyword_id, end_offset) for
+            every keyword occurrence, longest first per end offset. end_offset
+            counts from the cursor's first byte and is one past the match.
+        */
+
+        auto &table = *cursor.table;
+        auto next = table.next.data();
+        auto classes = table.classes.data();
+        size_t nclasses = size_t(table.nclasses);
+        auto state = cursor.state;
+
+        for(size_t i = 0; i < length; i++) {
+            state = next[size_t(state) * nclasses + classes[static_cast<unsigned char>(data[i])]];
+            for(auto s = own[state] != -1 ? state : suffix[state]; s != -1; s = suffix[s]) {
+                match(uint32_t(own[s]), cursor.offset + i + 1);
+            }
+        }
+
+        cursor.state = state;
+        cursor.offset += length;
+    }
+};
+
+class AhoCorasickBuilder {
+    /*
+        Collects keywords into a byte trie and resolves its failure links
+        into complete transitions.
+
+        Usage:
+            AhoCorasickBuilder builder;
+            auto id = builder.addKeyword("needle");
+            AhoCorasick matcher = builder.build();
+
+        Only transitions that do not lead back to the root become edges; all
+        other bytes take the node's ANY_SYMBOL edge to the root, so the
+        diagram stays proportional to the trie rather than to 256 times it.
+
+        @param vector< vector<pair<uint8_t, int32_t>> > children: trie edges per node
+        @param vector<int32_t> terminal: keyword id ending at each node, -1 if none
+        @param vector<string> keywords: keywords by id
+    */
+
+    std::vector<std::vector<std::pair<uint8_t, int32_t>>> children;
+    std::vector<int32_t> terminal;
+    std::vector<std::string> keywords;
+    std::unordered_map<std::string, uint32_t> ids;
+
+    int32_t child(int32_t node, uint8_t byte) const {
+        for(auto &edge: children[node]) {
+            if(edge.first == byte) return edge.second;
+        }
+        return -1;
+    }
+
+public:
+    AhoCorasickBuilder() : children(1), terminal(1, -1) {}
+
+    uint32_t addKeyword(const std::string& keyword) {
+        /*
+            Insert a keyword; adding a keyword twice returns its first id.
+
+            @return uint32_t id: keyword id, ids count up from 0
+        */
+
+        if(keyword.empty()) throw std::invalid_argument("AhoCorasickBuilder: empty keyword");
+        auto found = ids.find(keyword);
+        if(found != ids.end()) return found->second;
+
+        int32_t node = 0;
+        for(char c: keyword) {
+            auto byte = static_cast<uint8_t>(c);
+            auto next = child(node, byte);
+            if(next == -1) {
+                next = int32_t(children.size());
+                children[node].emplace_back(byte, next);
+                children.emplace_back();
+                terminal.push_back(-1);
+            }
+            node = next;
+        }
+
+        auto id = uint32_t(keywords.size());
+        terminal[node] = int32_t(id);
+        keywords.push_back(keyword);
+        ids.emplace(keyword, id);
+        return id;
+    }
+
+    AhoCorasick build(bool stop_at_first = false) const {
+        /*
+            Build the automaton.
+
+            @param bool stop_at_first: instead merge every accepting node into
+                one absorbing final state f = nodes + 1, giving a plain
+                "contains any keyword" DFA for DFA::execute, execute_batch or
+                a .gph file; acceptId then only reports the final state as
+                keyword 0 (no particular keyword)
+            @return AhoCorasick matcher
+        */
+
+        auto nnodes = children.size();
+        if(nnodes + 2 > size_t(std::numeric_limits<int32_t>::max())) throw std::out_of_range("AhoCorasickBuilder: too many trie nodes");
+
+        /* Bytes used by any keyword; every other byte leads to the root from everywhere */
+        std::array<int, 256> column;
+        column.fill(-1);
+        std::vector<uint8_t> alphabet;
+        for(auto &edges: children) {
+            for(auto &edge: edges) {
+                if(column[edge.first] != -1) continue;
+                column[edge.first] = int(alphabet.size());
+                alphabet.push_back(edge.first);
+            }
+        }
+        auto width = alphabet.size();
+
+        /* BFS: delta over the used bytes, failure links and dictionary suffix links */
+        std::vector<int32_t> delta(nnodes * width, 0);
+        std::vector<int32_t> fail(nnodes, 0);
+        std::vector<int32_t> dict(nnodes, -1);
+        std::vector<int32_t> order {0};
+        order.reserve(nnodes);
+        for(auto &edge: children[0]) delta[column[edge.first]] = edge.second;
+        for(size_t head = 0; head < order.size(); head++) {
+            auto node = order[head];
+            auto row = delta.begin() + size_t(node) * width;
+            if(node != 0) {
+                std::copy_n(delta.begin() + size_t(fail[node]) * width, width, row);
+            }
+            for(auto &edge: children[node]) {
+                auto next = edge.second;
+                if(node != 0) {
+                    fail[next] = row[column[edge.first]];
+                    dict[next] = terminal[fail[next]] != -1 ? fail[next] : dict[fail[next]];
+                }
+                row[column[edge.first]] = next;
+                order.push_back(next);
+            }
+        }
+
+        /* Trie node n is state n + 1 */
+        int32_t f = stop_at_first ? int32_t(nnodes) + 1 : -1;
+        auto accepting = [&](int32_t node) {
+            return terminal[node] != -1 or dict[node] != -1;
+        };
+        auto state_of = [&](int32_t node) {
+            return stop_at_first and accepting(node) ? f : node + 1;
+        };
+
+        StateDiagramBuilder builder;
+        for(size_t node = 0; node < nnodes; node++) {
+            builder.addVertex();
+            if(stop_at_first and accepting(int32_t(node))) continue;
+            for(size_t k = 0; k < width; k++) {
+                auto next = delta[node * width + k];
+                if(next == 0) continue;
+                builder.insertEdge(int(node) + 1, static_cast<signed char>(alphabet[k]), state_of(next));
+            }
+            if(node != 0) builder.insertEdge(int(node) + 1, ANY_SYMBOL, 1);
+        }
+        if(stop_at_first) builder.addVertex();
+
+        AhoCorasick matcher;
+        matcher.automaton = DFA(builder.finalize(), 1, f).freeze();
+        auto nstates = size_t(matcher.automaton->getTable().nstates);
+        matcher.own.assign(nstates, -1);
+        matcher.suffix.assign(nstates, -1);
+        for(size_t node = 0; node < nnodes; node++) {
+            if(stop_at_first) continue;
+            matcher.own[node + 1] = terminal[node];
+            matcher.suffix[node + 1] = dict[node] == -1 ? -1 : dict[node] + 1;
+        }
+        if(stop_at_first) matcher.own[f] = 0;
+        matcher.keywords = keywords;
+
+        return matcher;
+    }
+};
+
+#endif
@@ -0,0 +1,398 @@
+/*
+    DFA benchmark suite
+
+    Measures load time, throughput and per-call latency of every execution
+    engine over a grid of synthetic automata and inputs, with hardware
+    counters (cycles, instructions, L1D/LLC/dTLB misses, branch misses) per
+    byte where perf_event_open allows. Results are written as CSV to stdout.
+
+    Usage:
+        ./dfa_bench [--states 3,30,...] [--alphabet 2,16,...] [--length 16,...]
+                    [--density 0.1,...] [--shape random|chain|substring|aho]
+                    [--min-time <seconds>] [--seed <n>]
+*/
+#include "dfa.hpp"
+#include "synth.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+typedef std::chrono::steady_clock Clock;
+
+class PerfCounters {
+    /*
+        Hardware performance counters of the calling thread via
+        perf_event_open(2), user space only.
+
+        Each event is opened on its own so one unsupported event (or a VM
+        without a PMU, or perf_event_paranoid) only drops that column;
+        values are scaled for multiplexing and are NaN when unavailable.
+    */
+
+    struct Event {
+        const char* name;
+        uint32_t type;
+        uint64_t config;
+        int fd;
+    };
+
+    std::vector<Event> events;
+
+    static uint64_t cache_event(uint64_t cache, uint64_t op, uint64_t result) {
+        return cache | (op << 8) | (result << 16);
+    }
+
+public:
+    PerfCounters() {
+        events = {
+            {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+            {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+            {"l1d_misses", PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), -1},
+            {"llc_misses", PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), -1},
+            {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1},
+            {"dtlb_misses", PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), -1},
+        };
+
+        for(auto &event: events) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = event.type;
+            attr.config = event.config;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            event.fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+        for(auto &event: events) {
+            if(event.fd >= 0) close(event.fd);
+        }
+    }
+
+    std::string header() const {
+        std::string columns;
+        for(auto &event: events) columns += std::string(",") + event.name + "_per_byte";
+        return columns;
+    }
+
+    bool available() const {
+        for(auto &event: events) {
+            if(event.fd >= 0) return true;
+        }
+        return false;
+    }
+
+    void start() {
+        for(auto &event: events) {
+            if(event.fd < 0) continue;
+            ioctl(event.fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(event.fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    std::vector<double> stop() {
+        std::vector<double> values;
+        for(auto &event: events) {
+            double value = NAN;
+            if(event.fd >= 0) {
+                ioctl(event.fd, PERF_EVENT_IOC_DISABLE, 0);
+                uint64_t data[3];
+                if(read(event.fd, data, sizeof(data)) == sizeof(data) and data[2] > 0) {
+                    value = double(data[0]) * double(data[1]) / double(data[2]);
+                }
+            }
+            values.push_back(value);
+        }
+        return values;
+    }
+};
+
+struct BenchConfig {
+    std::vector<int> states {3, 30, 300, 10000, 1000000};
+    std::vector<int> alphabets {2, 16, 64};
+    std::vector<size_t> lengths {16, 1024, 65536};
+    std::vector<double> densities {0.1, 0.5, 0.9};
+    Shape shape = Shape::Random;
+    double min_time = 0.05;
+    uint64_t seed = 42;
+};
+
+struct Measurement {
+    size_t calls = 0;
+    size_t bytes = 0;
+    double seconds = 0;
+    size_t accepted = 0;
+    std::vector<double> counters;
+};
+
+static const size_t CORPUS_BYTES = 1 << 20;
+static const size_t FLOW_PACKET_BYTES = 64;
+static const size_t MAX_STRIDE_BYTES = size_t(1) << 28;
+/* StateMap::of costs O(nstates) per input; skip it where that dwarfs the input */
+static const int MAX_STATEMAP_STATES = 1000;
+
+template<class T>
+static std::vector<T> parse_list(const std::string& arg) {
+    std::vector<T> values;
+    for(auto &item: split(arg, ',')) {
+        std::istringstream in(item);
+        T value;
+        if(!(in>>value)) throw std::invalid_argument("bad list value: " + item);
+        values.push_back(value);
+    }
+    return values;
+}
+
+template<class Run>
+static Measurement measure(PerfCounters& perf, size_t calls, size_t bytes, double min_time, Run run) {
+    /*
+        Repeat run() until min_time has elapsed, counting hardware events.
+
+        @param size_t calls: calls made by one run()
+        @param size_t bytes: bytes processed by one run()
+        @param Run run: one round of work, returns the number accepted
+    */
+
+    Measurement m;
+    perf.start();
+    auto start = Clock::now();
+    do {
+        m.accepted = run();
+        m.calls += calls;
+        m.bytes += bytes;
+        m.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    } while(m.seconds < min_time);
+    m.counters = perf.stop();
+
+    return m;
+}
+
+template<class Run>
+static Measurement measure(PerfCounters& perf, const std::vector<std::string>& inputs, double min_time, Run run) {
+    size_t bytes = 0;
+    for(auto &input: inputs) bytes += input.size();
+
+    return measure(perf, inputs.size(), bytes, min_time, run);
+}
+
+static void report(const std::string& engine, int states, int alphabet, size_t length, double density, const Measurement& m) {
+    std::printf("%s,%d,%d,%zu,%.2f,%zu,%zu,%.6f,%.1f,%.1f,%zu",
+        engine.c_str(), states, alphabet, length, density, m.calls, m.bytes, m.seconds,
+        m.calls ? m.seconds * 1e9 / m.calls : 0.0,
+        m.seconds > 0 ? m.bytes / m.seconds / 1e6 : 0.0,
+        m.accepted);
+    for(auto value: m.counters) {
+        if(std::isnan(value) or m.bytes == 0) std::printf(",");
+        else std::printf(",%.4f", value / m.bytes);
+    }
+    std::printf("\n");
+}
+
+static void bench_automaton(const BenchConfig& config, PerfCounters& perf, int nstates, int alphabet, std::mt19937_64& rng) {
+    auto automaton = synth_automaton(config.shape, nstates, alphabet, alphabet, rng);
+    auto &diagram = automaton.diagram;
+    int q = automaton.q, f = automaton.f;
+
+    /* Load: parse the .gph file and compile the table */
+    char path[] = "/tmp/dfa_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) throw std::runtime_error("cannot create temporary file");
+    close(fd);
+    write_gph(path, diagram, q, f);
+
+    struct stat st;
+    stat(path, &st);
+
+    DFA dfa;
+    report("load", nstates, alphabet, 0, 0, measure(perf, 1, size_t(st.st_size), config.min_time, [&] {
+        dfa = build_dfa_from_file(path);
+        return size_t(0);
+    }));
+    unlink(path);
+
+    /* Compile: the transition table and the prefilter the first CompiledDFA::execute extracts */
+    report("compile", nstates, alphabet, 0, 0, measure(perf, 1, 0, config.min_time, [&] {
+        auto table = dfa.compile();
+        Prefilter prefilter(table);
+        return size_t(prefilter.active());
+    }));
+
+    auto table = dfa.compile();
+    auto compiled = DFA(diagram, q, f).freeze();
+
+    for(auto length: config.lengths) {
+        for(auto density: config.densities) {
+            auto count = std::max<size_t>(16, CORPUS_BYTES / std::max<size_t>(1, length));
+            auto inputs = synth_inputs(table, alphabet, count, length, density, rng);
+
+            std::vector<Span> spans;
+            for(auto &input: inputs) spans.push_back(Span{input.data(), input.size()});
+            std::vector<uint8_t> results(inputs.size());
+
+            report("linear", nstates, alphabet, length, density, measure(perf, inputs, config.min_time, [&] {
+                size_t accepted = 0;
+                for(auto &input: inputs) accepted += dfa.execute(input);
+                return accepted;
+            }));
+
+            report("table", nstates, alphabet, length, density, measure(perf, inputs, config.min_time, [&] {
+                size_t accepted = 0;
+                for(auto &input: inputs) {
+                    Cursor cursor(table);
+                    cursor.feed(input.data(), input.size());
+                    accepted += cursor.accepted();
+                }
+                return accepted;
+            }));
+
+            if(StrideTable::bytesFor(table) <= MAX_STRIDE_BYTES) {
+                StrideTable stride(table);
+                report("stride", nstates, alphabet, length, density, measure(perf, inputs, config.min_time, [&] {
+                    size_t accepted = 0;
+                    for(auto &input: inputs) {
+                        Cursor cursor(table, &stride);
+                        cursor.feed(input.data(), input.size());
+                        accepted += cursor.accepted();
+                    }
+                    return accepted;
+                }));
+            }
+
+            if(alphabet == 2 and size_t(table.nstates) * 256 * sizeof(int32_t) <= MAX_STRIDE_BYTES) {
+                /* Inputs packed eight symbols per byte, '0' = bit 0 */
+                BitTable bits(table, char(SYMBOL_BASE), char(SYMBOL_BASE + 1));
+                std::vector<std::vector<uint8_t>> packed(inputs.size());
+                for(size_t k = 0; k < inputs.size(); k++) {
+                    packed[k].assign((inputs[k].size() + 7) / 8, 0);
+                    for(size_t i = 0; i < inputs[k].size(); i++) {
+                        if(inputs[k][i] != char(SYMBOL_BASE)) packed[k][i / 8] |= uint8_t(0x80 >> (i % 8));
+                    }
+                }
+                report("bits", nstates, alphabet, length, density, measure(perf, inputs, config.min_time, [&] {
+                    size_t accepted = 0;
+                    for(size_t k = 0; k < inputs.size(); k++) {
+                        Cursor cursor(table);
+                        cursor.feedBits(bits, packed[k].data(), inputs[k].size());
+                        accepted += cursor.accepted();
+                    }
+                    return accepted;
+                }));
+            }
+
+            report("batch", nstates, alphabet, length, density, measure(perf, inputs, config.min_time, [&] {
+                execute_batch(table, spans.data(), spans.size(), results.data());
+                size_t accepted = 0;
+                for(auto r: results) accepted += r;
+                return accepted;
+            }));
+
+            report("shared", nstates, alphabet, length, density, measure(perf, inputs, config.min_time, [&] {
+                execute_batch_shared(table, spans.data(), spans.size(), results.data());
+                size_t accepted = 0;
+                for(auto r: results) accepted += r;
+                return accepted;
+            }));
+
+            compiled->getPrefilter();
+            report("prefilter", nstates, alphabet, length, density, measure(perf, inputs, config.min_time, [&] {
+                compiled->executeBatch(spans.data(), spans.size(), results.data());
+                size_t accepted = 0;
+                for(auto r: results) accepted += r;
+                return accepted;
+            }));
+
+            /* Sized to hold the corpus, so every round after the first only hits */
+            ResultCache cache(inputs.size());
+            report("cache", nstates, alphabet, length, density, measure(perf, inputs, config.min_time, [&] {
+                size_t accepted = 0;
+                for(auto &input: inputs) accepted += cache.execute(*compiled, input);
+                return accepted;
+            }));
+
+            /* Every input is a flow, sent as FLOW_PACKET_BYTES packets interleaved across all flows */
+            std::vector<uint64_t> keys;
+            std::vector<Span> packets;
+            size_t longest = 0;
+            for(auto &input: inputs) longest = std::max(longest, input.size());
+            for(size_t offset = 0; offset < longest; offset += FLOW_PACKET_BYTES) {
+                for(size_t k = 0; k < inputs.size(); k++) {
+                    if(offset >= inputs[k].size()) continue;
+                    keys.push_back(k);
+                    packets.push_back(Span{inputs[k].data() + offset, std::min(FLOW_PACKET_BYTES, inputs[k].size() - offset)});
+                }
+            }
+            FlowTable<> flows(compiled, inputs.size());
+            std::vector<uint8_t> packet_results(packets.size());
+            report("flow", nstates, alphabet, length, density, measure(perf, inputs, config.min_time, [&] {
+                flows.clear();
+                flows.feedBatch(keys.data(), packets.data(), packets.size(), 0, packet_results.data());
+                size_t accepted = 0;
+                uint32_t state;
+                for(size_t k = 0; k < inputs.size(); k++) accepted += flows.find(k, state) and int(state) == table.f;
+                return accepted;
+            }));
+
+            if(nstates <= MAX_STATEMAP_STATES) {
+                report("statemap", nstates, alphabet, length, density, measure(perf, inputs, config.min_time, [&] {
+                    size_t accepted = 0;
+                    for(auto &input: inputs) {
+                        accepted += StateMap::of(table, input.data(), input.size())[table.q] == table.f;
+                    }
+                    return accepted;
+                }));
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+
+    try {
+        for(auto i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if(i + 1 >= argc) throw std::invalid_argument("missing value for " + arg);
+            std::string value = argv[++i];
+
+            if(arg == "--states") config.states = parse_list<int>(value);
+            else if(arg == "--alphabet") config.alphabets = parse_list<int>(value);
+            else if(arg == "--length") config.lengths = parse_list<size_t>(value);
+            else if(arg == "--density") config.densities = parse_list<double>(value);
+            else if(arg == "--shape") config.shape = parse_shape(value);
+            else if(arg == "--min-time") config.min_time = std::stod(value);
+            else if(arg == "--seed") config.seed = std::stoull(value);
+            else throw std::invalid_argument("unknown option " + arg);
+        }
+
+        std::mt19937_64 rng(config.seed);
+        PerfCounters perf;
+        if(!perf.available()) std::fprintf(stderr, "Hardware counters unavailable, counter columns left empty\n");
+
+        std::printf("engine,states,alphabet,length,density,calls,bytes,seconds,ns_per_call,mb_per_s,accepted%s\n", perf.header().c_str());
+        for(auto nstates: config.states) {
+            for(auto alphabet: config.alphabets) {
+                bench_automaton(config, perf, nstates, alphabet, rng);
+                std::fflush(stdout);
+            }
+        }
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -2,325 +2,1120 @@
     Deterministic Finite Automaton
         - arush15june 25/03/2019
 */
-#include <iostream>
-#include <array>
-#include <vector>
-#include <utility>
-#include <string>
-#include <sstream>
-#include <fstream>
-#include <algorithm> 
-#include <cctype>
-#include <locale>
-
-#define MAXVERT 1000
-
-struct StateDiagram {
+#include "dfa.hpp"
+
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+class UringReader {
     /*
-        State diagram as an edge weight undirected graph
-
-        @param vector< vector<pair<int, int>> > states: list of adjacency list
-            pair.first => edge weight used as input director, -1 if none
-                Edge Weight in ASCII represents string to select.
-            pair.second => state no, -1 if first state
-        @param vector<int> degree: outdegrees of all states
-        @param int nvertices: number of vertices
-        @param int nedges: number of edges
+        Sequential file reader on io_uring with registered buffers.
+
+        Keeps up to `depth` fixed-buffer reads in flight per file and hands
+        completed buffers to the consumer strictly in file order, so they
+        can be fed straight into a Cursor. Uses raw syscalls; when io_uring
+        is unavailable (old kernel, seccomp, RLIMIT_MEMLOCK) every read
+        falls back to plain pread into the same buffers.
+
+        @param unsigned depth: reads in flight (and number of buffers)
+        @param size_t buffer_bytes: size of every buffer
     */
 
+    struct Slot {
+        uint64_t offset;
+        int64_t result;
+        bool done;
+    };
+
+    int ring_fd = -1;
+    unsigned depth;
+    size_t buffer_bytes;
+    std::vector<char> storage;
+    std::vector<Slot> slots;
 
-    std::array<std::vector<std::pair<int, int>>, MAXVERT+1> states;
-    std::array<int, MAXVERT+1> degree;
-    int nvertices;
-    int nedges;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    size_t sq_ring_bytes = 0;
+    size_t cq_ring_bytes = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_bytes = 0;
 
-    StateDiagram() {
-        nvertices = 0;
-        nedges = 0;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+
+    char* buffer(unsigned slot) {
+        return storage.data() + size_t(slot) * buffer_bytes;
     }
 
-    std::vector<std::pair<int, int> > getState(int index) {
-        /*
-            get the adjacency list vector for a certain state
+    bool setup() {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring_fd = int(syscall(__NR_io_uring_setup, depth, &params));
+        if(ring_fd < 0) return false;
 
-            @param int index: state no
-            @return std::vector<std::pair<int, int>> adjList: adjacency list of state `index`
-        */
+        sq_ring_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(single_mmap) sq_ring_bytes = cq_ring_bytes = std::max(sq_ring_bytes, cq_ring_bytes);
 
-        return states[index];
+        sq_ring = mmap(nullptr, sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if(sq_ring == MAP_FAILED) return false;
+        if(single_mmap) {
+            cq_ring = sq_ring;
+        }
+        else {
+            cq_ring = mmap(nullptr, cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if(cq_ring == MAP_FAILED) return false;
+        }
+
+        sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes_map = mmap(nullptr, sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if(sqes_map == MAP_FAILED) return false;
+        sqes = static_cast<io_uring_sqe*>(sqes_map);
+
+        auto sq = static_cast<char*>(sq_ring);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        auto cq = static_cast<char*>(cq_ring);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        std::vector<iovec> iovecs(depth);
+        for(unsigned i = 0; i < depth; i++) iovecs[i] = iovec{buffer(i), buffer_bytes};
+        return syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iovecs.data(), depth) == 0;
     }
 
-    void insertEdge(int state_no, int weight, int y) {
-        /*
-            Add edge to an adjacency list.
+    void teardown() {
+        if(sqes != MAP_FAILED) munmap(sqes, sqes_bytes);
+        if(cq_ring != MAP_FAILED and cq_ring != sq_ring) munmap(cq_ring, cq_ring_bytes);
+        if(sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_bytes);
+        if(ring_fd >= 0) close(ring_fd);
+        sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+        cq_ring = sq_ring = MAP_FAILED;
+        ring_fd = -1;
+    }
 
-            @param int state_no: state to add to
-            @param int weight: weight of edge
-            @param int y: state no of edge
+    void queueRead(int fd, unsigned slot, uint64_t offset, size_t length) {
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+
+        auto &sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ_FIXED;
+        sqe.fd = fd;
+        sqe.off = offset;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer(slot));
+        sqe.len = unsigned(length);
+        sqe.buf_index = uint16_t(slot);
+        sqe.user_data = slot;
+
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    void enter(unsigned to_submit, unsigned min_complete) {
+        while(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+            if(errno != EINTR) throw std::runtime_error(std::string("io_uring_enter failed: ") + strerror(errno));
+            to_submit = 0;
+        }
+    }
+
+    unsigned reap() {
+        /*
+            @return unsigned completed: completions moved into their slots
         */
-        
-        auto pair = std::make_pair(weight, y);
-        auto& state = states[state_no];
-        
-        state.push_back(pair);
-    }
-
-    void printList() {
-        for(auto i = 1; i <= nvertices; i++) {
-            auto adjList = states[i];
-            std::cout<<i<<": ";
-            for (auto pair: adjList) {
-                std::cout<<pair.first<<" "<<pair.second<<" ";
-            }
-            std::cout<<std::endl;
+
+        unsigned head = *cq_head, completed = 0;
+        while(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            auto &cqe = cqes[head & *cq_mask];
+            auto &slot = slots[cqe.user_data];
+            slot.result = cqe.res;
+            slot.done = true;
+            head++;
+            completed++;
         }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return completed;
     }
-};
 
-class DFA {
-    /*
-        Executes a DFA over input symbols.
-
-        Elements of a DFA
-        Q: Finite Set of states
-            Represented via StateDiagram
-        E: Input symbols
-            Represented as a string (std::string)
-        q: initial state
-            represented as an integer
-        f: final state
-            represented as an integer
-
-        @param StateDiagram state_diagram: state diagram; q
-        @param int q: initial state
-        @param int f: final state
-    */
-    StateDiagram state_diagram;
-    int q;
-    int f;
+    static int64_t preadFull(int fd, char* data, size_t length, uint64_t offset) {
+        size_t total = 0;
+        while(total < length) {
+            auto got = pread(fd, data + total, length - total, off_t(offset + total));
+            if(got < 0) {
+                if(errno == EINTR) continue;
+                return -errno;
+            }
+            if(got == 0) break;
+            total += size_t(got);
+        }
+        return int64_t(total);
+    }
 
 public:
-    DFA() {};
-    DFA(StateDiagram graph, int init_state, int final_state) : state_diagram {graph}, q{init_state}, f{final_state} {}
+    explicit UringReader(unsigned queue_depth = 16, size_t bytes = 1 << 20) : depth{queue_depth}, buffer_bytes{bytes} {
+        storage.resize(size_t(depth) * buffer_bytes);
+        slots.resize(depth);
+        if(!setup()) teardown();
+    }
 
-    bool execute(std::string input) {
+    UringReader(const UringReader&) = delete;
+    UringReader& operator=(const UringReader&) = delete;
+
+    ~UringReader() {
+        teardown();
+    }
+
+    bool available() const {
+        return ring_fd >= 0;
+    }
+
+    template<class Consumer>
+    void readFile(int fd, uint64_t size, Consumer consume) {
         /*
-        Execute the DFA over the input string.
-
-        TODO: Templatize for any type of vector of input symbols
-
-        Algorithm
-            1) set current state to q i.e initial state of DFA.
-            2) Iterate over the string.
-                a) get the adjacency list for the current state.
-                b) Iterate over the adjancency list
-                    i) if the state's weight is same as the current symbols ASCII value
-                        set the current state to the state's no and break the iteration.
-            3) If the current state is same as the final state, set the final_state_reached flag true
-            4) return final_state_reached
-
-        @param std::string input: Input string to execute DFA on.
-        @return bool final_state_reached: True if the final state was reached, else False.
+            Read [0, size) of fd and call consume(const char*, size_t) for
+            every buffer in file order.
         */
 
-        bool final_state_reached = false;
-        int current_state = q; 
+        if(!available()) {
+            for(uint64_t offset = 0; offset < size; offset += buffer_bytes) {
+                auto got = preadFull(fd, buffer(0), size_t(std::min<uint64_t>(buffer_bytes, size - offset)), offset);
+                if(got < 0) throw std::runtime_error(std::string("read failed: ") + strerror(int(-got)));
+                if(got == 0) break;
+                consume(buffer(0), size_t(got));
+            }
+            return;
+        }
 
-        for(char symbol: input) {
-            auto symbol_val = int(symbol);
-            auto curr_adj_list = state_diagram.getState(current_state);
+        /* in_flight: slots not consumed yet; pending: reads the kernel has not completed */
+        uint64_t issued = 0;
+        unsigned queued = 0, in_flight = 0, pending = 0;
+        auto issue = [&](unsigned slot) {
+            auto length = size_t(std::min<uint64_t>(buffer_bytes, size - issued));
+            slots[slot] = Slot{issued, 0, false};
+            queueRead(fd, slot, issued, length);
+            issued += length;
+            queued++;
+            in_flight++;
+            pending++;
+        };
 
-            for(auto &state: curr_adj_list) {
-                if(state.first == symbol_val and state.second != current_state) {
-                    current_state = state.second;
-                    break;
+        for(unsigned slot = 0; slot < depth and issued < size; slot++) issue(slot);
+
+        unsigned next_slot = 0;
+        while(in_flight > 0) {
+            auto &slot = slots[next_slot];
+            if(!slot.done) {
+                enter(queued, 1);
+                queued = 0;
+                pending -= reap();
+                continue;
+            }
+            in_flight--;
+
+            auto expected = size_t(std::min<uint64_t>(buffer_bytes, size - slot.offset));
+            if(slot.result >= 0 and size_t(slot.result) < expected) {
+                auto rest = preadFull(fd, buffer(next_slot) + slot.result, expected - size_t(slot.result), slot.offset + slot.result);
+                slot.result = rest < 0 ? rest : slot.result + rest;
+            }
+            if(slot.result < 0) {
+                /* Drain the ring before bailing out so no read targets a reused buffer */
+                while(pending > 0) {
+                    enter(queued, 1);
+                    queued = 0;
+                    pending -= reap();
                 }
+                throw std::runtime_error(std::string("read failed: ") + strerror(int(-slot.result)));
             }
+
+            consume(buffer(next_slot), size_t(slot.result));
+            if(issued < size) issue(next_slot);
+            next_slot = (next_slot + 1) % depth;
         }
+    }
+};
 
+static void collect_files(const std::string& path, std::vector<std::string>& files) {
+    /*
+        Expand path into the regular files below it, in sorted order.
+    */
 
-        if(current_state == f) final_state_reached = true;
+    struct stat st;
+    if(stat(path.c_str(), &st) < 0 or !S_ISDIR(st.st_mode)) {
+        files.push_back(path);
+        return;
+    }
 
-        return final_state_reached;
+    DIR* dir = opendir(path.c_str());
+    if(!dir) {
+        files.push_back(path);
+        return;
     }
 
-    void setInitialState(int init_state) {
-        q = init_state;
+    std::vector<std::string> entries;
+    while(auto entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if(name == "." or name == "..") continue;
+        entries.push_back(path.back() == '/' ? path + name : path + "/" + name);
     }
-    
-    int getInitState() {
-        return q;
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end());
+    for(auto &entry: entries) collect_files(entry, files);
+}
+
+static const size_t PIECE_BYTES = 1 << 26;
+static const int MAX_PIECE_STATES = 64;
+
+struct ScanResult {
+    std::string path;
+    bool accepted = false;
+    std::string error;
+};
+
+static void scan_file_uring(const CompiledDFA& automaton, const std::string& path, ScanResult& result) {
+    /*
+        Scan one file through the calling worker's UringReader.
+    */
+
+    static thread_local UringReader reader;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        result.error = "cannot open " + path;
+        return;
     }
-    
-    void setFinalState(int final_state) {
-        f = final_state;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        result.error = "cannot stat " + path;
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    auto cursor = automaton.cursor();
+    try {
+        reader.readFile(fd, uint64_t(st.st_size), [&](const char* data, size_t length) {
+            cursor.feed(data, length);
+        });
+        result.accepted = cursor.accepted();
     }
+    catch(const std::exception& e) {
+        result.error = e.what();
+    }
+    close(fd);
+}
+
+std::vector<ScanResult> scan_files(const CompiledDFA& automaton, const std::vector<std::string>& paths, ThreadPool& pool, bool use_uring = false) {
+    /*
+        Run the DFA over every file (directories are walked recursively).
+
+        Every file is one task. With use_uring, files are streamed through
+        a per-worker UringReader into a Cursor instead. Otherwise mapped
+        files the prefilter rejects are not scanned, and files larger than
+        two pieces are split into PIECE_BYTES pieces when the automaton is
+        small enough: the first piece is scanned from q, the others compute
+        a StateMap, and the maps are chained once all pieces are done.
+
+        @param CompiledDFA automaton: compiled DFA
+        @param vector<string> paths: files or directories to scan
+        @param ThreadPool pool: workers to scan on
+        @param bool use_uring: read files through io_uring instead of mmap
+        @return vector<ScanResult> results: one per file, in walk order
+    */
+
+    auto &table = automaton.getTable();
+    std::vector<std::string> files;
+    for(auto &path: paths) collect_files(path, files);
+
+    std::vector<ScanResult> results(files.size());
+    std::vector<std::vector<StateMap>> pieces(files.size());
+
+    for(size_t i = 0; i < files.size(); i++) {
+        results[i].path = files[i];
+
+        if(use_uring) {
+            pool.submit([&, i] {
+                scan_file_uring(automaton, files[i], results[i]);
+            });
+            continue;
+        }
+
+        pool.submit([&, i] {
+            std::shared_ptr<MappedFile> file;
+            try {
+                file = std::make_shared<MappedFile>(files[i]);
+            }
+            catch(const std::exception& e) {
+                results[i].error = e.what();
+                return;
+            }
+            file->adviseSequential();
+            if(!automaton.getPrefilter().mayMatch(file->begin(), file->size())) return;
+
+            size_t npieces = file->size() / PIECE_BYTES;
+            if(npieces < 2 or table.nstates > MAX_PIECE_STATES) npieces = 1;
+
+            pieces[i].resize(npieces);
+            for(size_t k = 1; k < npieces; k++) {
+                pool.submit([&, i, k, file, npieces] {
+                    auto begin = file->begin() + k * PIECE_BYTES;
+                    auto end = k + 1 == npieces ? file->end() : begin + PIECE_BYTES;
+                    pieces[i][k] = StateMap::of(table, begin, size_t(end - begin));
+                });
+            }
 
-    int getFinalstate() {
-        return f;
+            auto cursor = automaton.cursor();
+            cursor.feed(file->begin(), npieces == 1 ? file->size() : PIECE_BYTES);
+            pieces[i][0].map.assign(1, cursor.state);
+        });
     }
+    pool.wait();
+
+    for(size_t i = 0; i < files.size(); i++) {
+        if(use_uring or !results[i].error.empty() or pieces[i].empty()) continue;
 
-    void setStateDiagram(StateDiagram diag) {
-        state_diagram = diag;
+        auto state = pieces[i][0][0];
+        for(size_t k = 1; k < pieces[i].size(); k++) state = pieces[i][k][state];
+        results[i].accepted = state == table.f;
     }
 
-    StateDiagram getStateDiagram() {
-        return state_diagram;
+    return results;
+}
+
+int scan_main(const std::string& dfa_filename, const std::vector<std::string>& paths, bool use_uring) {
+    /*
+        `--scan` mode: build the DFA once and evaluate every file.
+
+        Prints `<path>: True|False` per file in walk order.
+    */
+
+    auto automaton = build_dfa_from_file(dfa_filename).freeze();
+
+    ThreadPool pool;
+    auto results = scan_files(*automaton, paths, pool, use_uring);
+
+    std::string output;
+    int status = 0;
+    for(auto &result: results) {
+        output += result.path;
+        if(!result.error.empty()) {
+            output += ": Error: " + result.error + "\n";
+            status = 1;
+        }
+        else {
+            output += result.accepted ? ": True\n" : ": False\n";
+        }
     }
-    
+    std::cout<<output;
+
+    return status;
+}
+
+static void write_all(int fd, const char* data, size_t length) {
+    while(length > 0) {
+        auto written = write(fd, data, length);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            throw std::runtime_error(std::string("write failed: ") + strerror(errno));
+        }
+        data += written;
+        length -= size_t(written);
+    }
+}
+
+static const size_t LINE_BLOCK_BYTES = 1 << 22;
+
+struct LineBlock {
+    /*
+        One block of complete lines read from the input.
+
+        @param vector<char> data: carried-over partial line + bytes read
+        @param size_t length: bytes of complete lines in data
+        @param bool eof: no more input follows this block
+    */
+
+    std::vector<char> data;
+    size_t length = 0;
+    bool eof = false;
 };
 
-/* https://stackoverflow.com/questions/9435385/split-a-string-using-c11 */
-std::vector<std::string> split(const std::string &s, char delim) {
-    std::stringstream ss(s);
-    std::string item;
-    std::vector<std::string> elems;
-    while (std::getline(ss, item, delim)) {
-        elems.push_back(item);
-        // elems.push_back(std::move(item)); // if C++11 (based on comment from @mchiasson)
+struct LinePart {
+    const char* begin;
+    const char* end;
+    std::vector<Span> lines;
+    std::vector<uint8_t> results;
+    std::string output;
+    size_t accepted = 0;
+};
+
+static void read_line_block(int fd, LineBlock& block, std::vector<char>& carry) {
+    /*
+        Fill block with carry followed by up to LINE_BLOCK_BYTES of input,
+        cut after the last newline. The remainder becomes the next carry;
+        at end of input the unterminated last line is kept as a line.
+    */
+
+    block.data.swap(carry);
+    carry.clear();
+    auto used = block.data.size();
+    block.data.resize(used + LINE_BLOCK_BYTES);
+
+    while(used < block.data.size()) {
+        auto got = read(fd, block.data.data() + used, block.data.size() - used);
+        if(got < 0) {
+            if(errno == EINTR) continue;
+            throw std::runtime_error(std::string("read failed: ") + strerror(errno));
+        }
+        if(got == 0) {
+            block.eof = true;
+            break;
+        }
+        used += size_t(got);
+    }
+    block.data.resize(used);
+
+    block.length = used;
+    if(!block.eof) {
+        auto last = static_cast<const char*>(memrchr(block.data.data(), '\n', used));
+        block.length = last ? size_t(last - block.data.data()) + 1 : 0;
+        carry.assign(block.data.begin() + block.length, block.data.end());
     }
-    return elems;
 }
 
-/* https://stackoverflow.com/questions/216823/whats-the-best-way-to-trim-stdstring */
-// trim from start (in place)
-static inline void ltrim(std::string &s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](int ch) {
-        return !std::isspace(ch);
-    }));
+int lines_main(const std::string& dfa_filename, const std::string& input_filename, bool count_only, bool profile, bool watch) {
+    /*
+        `--lines` mode: evaluate every newline-delimited record of a file or
+        stdin and write the accepted lines (or, with --count, their number).
+
+        Input is read in LINE_BLOCK_BYTES blocks. A block is split at line
+        boundaries into one part per worker; lines are evaluated in place
+        through Spans into the block and accepted lines are appended to the
+        part's output buffer. Parts are written in order, so the output
+        keeps the input order, while the next block is being read.
+
+        With profile, state and transition visits are counted and printed
+        as a heatmap on stderr at the end.
+
+        With watch, the DFA file is reloaded in the background whenever it
+        changes; every block runs on the version current when it started.
+    */
+
+    std::unique_ptr<DFAWatcher> watcher(watch ? new DFAWatcher(dfa_filename) : nullptr);
+    auto automaton = watcher ? watcher->load() : build_dfa_from_file(dfa_filename).freeze();
+    std::unique_ptr<VisitCounters> counters(profile ? new VisitCounters(automaton->getTable()) : nullptr);
+
+    int fd = 0;
+    if(!input_filename.empty() and input_filename != "-") {
+        fd = open(input_filename.c_str(), O_RDONLY);
+        if(fd < 0) throw std::runtime_error("cannot open " + input_filename);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    ThreadPool pool;
+    std::vector<LinePart> parts(pool.size());
+    LineBlock blocks[2];
+    std::vector<char> carry;
+    size_t accepted = 0;
+
+    auto process = [&](LineBlock& block) {
+        const char* base = block.data.data();
+        const char* begin = base;
+        const char* end = base + block.length;
+        if(watcher) automaton = watcher->load();
+
+        for(size_t k = 0; k < parts.size(); k++) {
+            auto cut = end;
+            if(k + 1 < parts.size()) {
+                cut = std::max(begin, base + block.length * (k + 1) / parts.size());
+                auto eol = cut == end ? nullptr : static_cast<const char*>(memchr(cut, '\n', end - cut));
+                cut = eol ? eol + 1 : end;
+            }
+
+            auto &part = parts[k];
+            part.begin = begin;
+            part.end = cut;
+            begin = cut;
+
+            pool.submit([&part, snapshot = automaton, &counters, count_only] {
+                auto &table = snapshot->getTable();
+                part.lines.clear();
+                for(auto p = part.begin; p != part.end;) {
+                    auto eol = static_cast<const char*>(memchr(p, '\n', part.end - p));
+                    auto line_end = eol ? eol : part.end;
+                    part.lines.push_back(Span{p, size_t(line_end - p)});
+                    p = eol ? eol + 1 : part.end;
+                }
+
+                part.results.resize(part.lines.size());
+                if(counters) {
+                    execute_batch(table, part.lines.data(), part.lines.size(), part.results.data(), counters->recorder());
+                }
+                else {
+                    snapshot->executeBatch(part.lines.data(), part.lines.size(), part.results.data());
+                }
+
+                for(size_t i = 0; i < part.lines.size(); i++) {
+                    if(!part.results[i]) continue;
+                    part.accepted++;
+                    if(!count_only) {
+                        part.output.append(part.lines[i].data, part.lines[i].size);
+                        part.output.push_back('\n');
+                    }
+                }
+            });
+        }
+    };
+
+    auto flush = [&] {
+        pool.wait();
+        for(auto &part: parts) {
+            accepted += part.accepted;
+            part.accepted = 0;
+            if(!part.output.empty()) write_all(1, part.output.data(), part.output.size());
+            part.output.clear();
+        }
+    };
+
+    int current = 0;
+    read_line_block(fd, blocks[current], carry);
+    while(true) {
+        process(blocks[current]);
+        if(blocks[current].eof) break;
+
+        read_line_block(fd, blocks[1 - current], carry);
+        flush();
+        current = 1 - current;
+    }
+    flush();
+
+    if(fd != 0) close(fd);
+
+    if(count_only) {
+        auto line = std::to_string(accepted) + "\n";
+        write_all(1, line.data(), line.size());
+    }
+    if(counters) automaton->getStateDiagram().printHeatmap(counters->profile(), std::cerr);
+
+    return 0;
 }
 
-// trim from end (in place)
-static inline void rtrim(std::string &s) {
-    s.erase(std::find_if(s.rbegin(), s.rend(), [](int ch) {
-        return !std::isspace(ch);
-    }).base(), s.end());
+static const size_t STREAM_BLOCK_BYTES = 1 << 20;
+static const uint64_t CHECKPOINT_INTERVAL_BYTES = uint64_t(1) << 28;
+
+static void write_checkpoint(const Cursor& cursor, VisitCounters* counters, const std::string& path) {
+    /*
+        Replace the checkpoint file atomically: write a temporary file,
+        fsync it and rename it over the old one.
+    */
+
+    auto temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        cursor.save(out, counters);
+        if(!out.flush()) throw std::runtime_error("cannot write " + temporary);
+    }
+    int fd = open(temporary.c_str(), O_RDONLY);
+    if(fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    if(rename(temporary.c_str(), path.c_str()) < 0) throw std::runtime_error("cannot rename " + temporary + " to " + path);
 }
 
-// trim from both ends (in place)
-static inline void trim(std::string &s) {
-    ltrim(s);
-    rtrim(s);
+int stream_main(const std::string& dfa_filename, const std::string& input_filename, const std::string& checkpoint_path, bool packed, bool profile) {
+    /*
+        `--stream` mode: run one cursor over a single long stream (a file or
+        stdin) and print True|False at its end.
+
+        With a checkpoint path, the cursor is restored from it when it
+        exists (the first `offset` input bytes are then skipped) and saved
+        to it every CHECKPOINT_INTERVAL_BYTES and at the end, so a scan
+        killed midway resumes where it was instead of from zero.
+
+        With packed, every input byte holds eight '0'/'1' symbols, high bit
+        first, consumed a byte per lookup through a BitTable; offsets then
+        count symbols.
+
+        With profile, visits are counted, carried in the checkpoint and
+        printed as a heatmap on stderr.
+    */
+
+    auto automaton = build_dfa_from_file(dfa_filename).freeze();
+    auto cursor = automaton->cursor();
+    std::unique_ptr<BitTable> bits(packed ? new BitTable(automaton->getTable()) : nullptr);
+    std::unique_ptr<VisitCounters> counters(profile ? new VisitCounters(automaton->getTable()) : nullptr);
+
+    if(!checkpoint_path.empty()) {
+        std::ifstream in(checkpoint_path, std::ios::binary);
+        if(in) cursor.restore(in, counters.get());
+    }
+
+    int fd = 0;
+    if(!input_filename.empty() and input_filename != "-") {
+        fd = open(input_filename.c_str(), O_RDONLY);
+        if(fd < 0) throw std::runtime_error("cannot open " + input_filename);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    std::vector<char> buffer(STREAM_BLOCK_BYTES);
+    auto read_block = [&](size_t length) {
+        while(true) {
+            auto got = read(fd, buffer.data(), length);
+            if(got >= 0) return size_t(got);
+            if(errno != EINTR) throw std::runtime_error(std::string("read failed: ") + strerror(errno));
+        }
+    };
+
+    /* Skip what the checkpoint already covers; pipes cannot seek */
+    if(bits and cursor.offset % 8) throw std::runtime_error("checkpoint offset is not a whole packed byte");
+    uint64_t skipped = bits ? cursor.offset / 8 : cursor.offset;
+    if(skipped > 0 and lseek(fd, off_t(skipped), SEEK_SET) < 0) {
+        while(skipped > 0) {
+            auto got = read_block(size_t(std::min<uint64_t>(skipped, buffer.size())));
+            if(got == 0) throw std::runtime_error("input is shorter than the checkpoint offset");
+            skipped -= got;
+        }
+    }
+
+    auto next_checkpoint = cursor.offset + CHECKPOINT_INTERVAL_BYTES;
+    while(auto got = read_block(buffer.size())) {
+        if(bits) cursor.feedBits(*bits, reinterpret_cast<const uint8_t*>(buffer.data()), got * 8);
+        else if(counters) cursor.feed(buffer.data(), got, counters->recorder());
+        else cursor.feed(buffer.data(), got);
+        if(!checkpoint_path.empty() and cursor.offset >= next_checkpoint) {
+            write_checkpoint(cursor, counters.get(), checkpoint_path);
+            next_checkpoint = cursor.offset + CHECKPOINT_INTERVAL_BYTES;
+        }
+    }
+    if(fd != 0) close(fd);
+
+    if(!checkpoint_path.empty()) write_checkpoint(cursor, counters.get(), checkpoint_path);
+    if(counters) automaton->getStateDiagram().printHeatmap(counters->profile(), std::cerr);
+
+    std::cout<<(cursor.accepted() ? "True" : "False")<<std::endl;
+    return cursor.accepted() ? 0 : 1;
 }
 
-// trim from start (copying)
-static inline std::string ltrim_copy(std::string s) {
-    ltrim(s);
-    return s;
+static const uint32_t SERVE_MAX_FRAME = 1 << 26;
+static const size_t SERVE_MAX_OUTPUT = 1 << 22;
+
+struct ServeConnection {
+    /*
+        Buffered state of one client of --serve.
+
+        @param string in: received bytes not yet consumed as frames
+        @param string out: encoded responses not yet sent
+        @param size_t sent: bytes of out already sent
+        @param bool reading: polled for EPOLLIN, off while SERVE_MAX_OUTPUT
+            or more bytes of out are unsent
+        @param bool writing: polled for EPOLLOUT, on while out is unsent
+    */
+
+    int fd;
+    std::string in;
+    std::string out;
+    size_t sent = 0;
+    bool reading = true;
+    bool writing = false;
+};
+
+static void append_u32(std::string& out, uint32_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
 }
 
-// trim from end (copying)
-static inline std::string rtrim_copy(std::string s) {
-    rtrim(s);
-    return s;
+static uint32_t read_u32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
 }
 
-// trim from both ends (copying)
-static inline std::string trim_copy(std::string s) {
-    trim(s);
-    return s;
+static void serve_frame(const char* body, size_t length, const std::vector<CompiledDFAPtr>& automata,
+                        const std::vector<std::unique_ptr<DFAWatcher>>& watchers, ResultCache* cache,
+                        std::vector<Span>& spans, std::vector<uint8_t>& results, std::string& out) {
+    /*
+        Evaluate one request body and append the response frame to out.
+    */
+
+    auto fail = [&](const std::string& message) {
+        append_u32(out, uint32_t(sizeof(uint32_t) + message.size()));
+        append_u32(out, 1);
+        out += message;
+    };
+
+    if(length < 2 * sizeof(uint32_t)) return fail("short request");
+    auto index = read_u32(body);
+    auto count = read_u32(body + 4);
+    if(index >= std::max(automata.size(), watchers.size())) return fail("no DFA " + std::to_string(index));
+
+    spans.clear();
+    size_t at = 8;
+    for(uint32_t i = 0; i < count; i++) {
+        if(length - at < sizeof(uint32_t)) return fail("truncated request");
+        auto size = read_u32(body + at);
+        at += sizeof(uint32_t);
+        if(length - at < size) return fail("truncated request");
+        spans.push_back(Span{body + at, size});
+        at += size;
+    }
+    if(at != length) return fail("trailing bytes in request");
+
+    auto automaton = watchers.empty() ? automata[index] : watchers[index]->load();
+    results.resize(spans.size());
+    if(cache) {
+        for(size_t i = 0; i < spans.size(); i++) results[i] = cache->execute(*automaton, spans[i].data, spans[i].size);
+    }
+    else automaton->executeBatch(spans.data(), spans.size(), results.data());
+
+    append_u32(out, uint32_t(sizeof(uint32_t) + results.size()));
+    append_u32(out, 0);
+    out.append(reinterpret_cast<const char*>(results.data()), results.size());
 }
 
-DFA build_dfa_from_file(std::string filename) {
+int serve_main(const std::string& socket_path, const std::vector<std::string>& dfa_filenames, bool watch, size_t cache_entries) {
     /*
-    Build DFA and StateDiagram from file.
-
-    File Structure:
-        (Adjacency List's)
-
-    First Line
-        q -> initial state
-    Second Line
-        f -> final state
-    Next Line(s):
-        <vertex_no>: <weight> <vertex_no> | [<weight> <vertex_no> ... | ...] 
-    ``` dfa.gph
-    1               -> initial state
-    2               -> final state
-    1: 97 2 | 37 3    -> Adjacency List for Node 1
-    2: 97 1 | 27 3
-    3: 37 1 | 27 2
-    ```
-
-    @param std::string filename: filename to read from
-    @return DFA dfa: returns a DFA.
+        `--serve` mode: keep DFAs loaded and evaluate batches sent over a
+        Unix domain socket.
+
+        Framing, all integers uint32 in host byte order:
+            request:  body_bytes | dfa_index | count | count x (length | bytes)
+            response: body_bytes | status | status 0: count result bytes (1 = accepted)
+                                            status 1: error message
+        dfa_index is the position of the DFA on the command line. Requests on
+        one connection may be pipelined and are answered in order.
+
+        A single epoll loop accepts connections, reads complete frames and
+        runs each batch through CompiledDFA::executeBatch. Frames over
+        SERVE_MAX_FRAME close the connection. A client that does not read
+        its responses stops being read once SERVE_MAX_OUTPUT bytes are
+        queued for it. With watch, every DFA file is hot reloaded through a
+        DFAWatcher. With cache_entries > 0 inputs are evaluated one by one
+        through a ResultCache shared by all DFAs.
     */
 
-    StateDiagram state_diagram;
-    DFA dfa;
-    
-    std::ifstream state_file(filename);
-    std::string str;
-    int counter = 0;
-    int nvertices, nedges;
+    std::vector<CompiledDFAPtr> automata;
+    std::vector<std::unique_ptr<DFAWatcher>> watchers;
+    for(auto &filename: dfa_filenames) {
+        if(watch) watchers.emplace_back(new DFAWatcher(filename));
+        else automata.push_back(build_dfa_from_file(filename).freeze());
+    }
+    std::unique_ptr<ResultCache> cache(cache_entries ? new ResultCache(cache_entries) : nullptr);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(socket_path.size() >= sizeof(address.sun_path)) throw std::runtime_error("socket path too long: " + socket_path);
+    memcpy(address.sun_path, socket_path.data(), socket_path.size());
+
+    struct stat st;
+    if(lstat(socket_path.c_str(), &st) == 0 and S_ISSOCK(st.st_mode)) unlink(socket_path.c_str());
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listen_fd < 0) throw std::runtime_error(std::string("socket failed: ") + strerror(errno));
+    if(bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 or listen(listen_fd, SOMAXCONN) < 0) {
+        auto error = std::string(strerror(errno));
+        close(listen_fd);
+        throw std::runtime_error("cannot listen on " + socket_path + ": " + error);
+    }
 
-    while(std::getline(state_file, str)) {
-        if(counter == 0) {
-            dfa.setInitialState(std::stoi(str));
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd < 0) throw std::runtime_error(std::string("epoll_create1 failed: ") + strerror(errno));
+
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+
+    std::cerr<<"Serving "<<dfa_filenames.size()<<" DFA(s) on "<<socket_path<<std::endl;
+
+    std::vector<Span> spans;
+    std::vector<uint8_t> results;
+    std::vector<char> buffer(1 << 16);
+    epoll_event events[64];
+
+    auto drop = [&](ServeConnection* connection) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, nullptr);
+        close(connection->fd);
+        delete connection;
+    };
+
+    auto pending = [](const ServeConnection* connection) {
+        return connection->out.size() - connection->sent;
+    };
+
+    auto flush = [&](ServeConnection* connection) {
+        /* Send what the socket takes; poll for EPOLLOUT while output is pending and for EPOLLIN while it is small */
+        while(connection->sent < connection->out.size()) {
+            auto written = send(connection->fd, connection->out.data() + connection->sent,
+                                connection->out.size() - connection->sent, MSG_NOSIGNAL);
+            if(written < 0) {
+                if(errno == EINTR) continue;
+                if(errno == EAGAIN or errno == EWOULDBLOCK) break;
+                return false;
+            }
+            connection->sent += size_t(written);
         }
-        else if(counter == 1){
-            dfa.setFinalState(std::stoi(str));
+        if(connection->sent == connection->out.size()) {
+            connection->out.clear();
+            connection->sent = 0;
         }
-        else {
-            /*  Build State Diagram
-                - Split at colon.
-                - set current state
-                - Split the part after colon at |
-                - Iterate over split at |
-                    - Trim whitespace
-                    - Split pair at space
-                    - Convert to integers
-                        weight -> pair[0]
-                        state_no_y -> pair[1]
-                    - insert edge in state diagram.
-            */
-            auto split_at_colon = split(str, ':');
-            auto state = std::stoi(split_at_colon[0]);
-
-            nvertices += 1;
-            
-            auto adj_list_vector = split(split_at_colon[1], '|');
-            auto degree = 0;
-            for(auto &pair: adj_list_vector) {
-                auto trimmed_pair = trim_copy(pair);
-                auto split_pair = split(trimmed_pair, ' ');
-                
-                int weight = std::stoi(split_pair[0]);
-                int state_no_y = std::stoi(split_pair[1]);
-                
-                state_diagram.insertEdge(state, weight, state_no_y);
-                nedges += 1;
-                degree += 1;
+
+        bool writing = !connection->out.empty();
+        bool reading = pending(connection) < SERVE_MAX_OUTPUT;
+        if(writing != connection->writing or reading != connection->reading) {
+            epoll_event update;
+            memset(&update, 0, sizeof(update));
+            update.events = (reading ? uint32_t(EPOLLIN) : 0u) | (writing ? uint32_t(EPOLLOUT) : 0u);
+            update.data.ptr = connection;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &update);
+            connection->writing = writing;
+            connection->reading = reading;
+        }
+        return true;
+    };
+
+    while(true) {
+        int nevents = epoll_wait(epoll_fd, events, 64, -1);
+        if(nevents < 0) {
+            if(errno == EINTR) continue;
+            throw std::runtime_error(std::string("epoll_wait failed: ") + strerror(errno));
+        }
+
+        for(int e = 0; e < nevents; e++) {
+            if(events[e].data.ptr == nullptr) {
+                int fd;
+                while((fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    auto connection = new ServeConnection;
+                    connection->fd = fd;
+                    epoll_event add;
+                    memset(&add, 0, sizeof(add));
+                    add.events = EPOLLIN;
+                    add.data.ptr = connection;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &add);
+                }
+                continue;
             }
-            state_diagram.degree[state] = degree;
+
+            auto connection = static_cast<ServeConnection*>(events[e].data.ptr);
+            bool open = true;
+
+            if(events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                /* One complete frame at most; the rest stays in the socket */
+                while(connection->in.size() < sizeof(uint32_t) + SERVE_MAX_FRAME) {
+                    auto got = recv(connection->fd, buffer.data(), buffer.size(), 0);
+                    if(got > 0) {
+                        connection->in.append(buffer.data(), size_t(got));
+                        continue;
+                    }
+                    if(got < 0 and errno == EINTR) continue;
+                    if(got < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) break;
+                    open = false;
+                    break;
+                }
+            }
+
+            /* Answer buffered frames while output stays under SERVE_MAX_OUTPUT, flushing in between */
+            bool alive = true;
+            while(alive) {
+                size_t at = 0;
+                while(pending(connection) < SERVE_MAX_OUTPUT and connection->in.size() - at >= sizeof(uint32_t)) {
+                    auto length = read_u32(connection->in.data() + at);
+                    if(length > SERVE_MAX_FRAME) {
+                        open = false;
+                        break;
+                    }
+                    if(connection->in.size() - at - sizeof(uint32_t) < length) break;
+                    serve_frame(connection->in.data() + at + sizeof(uint32_t), length, automata, watchers, cache.get(), spans, results, connection->out);
+                    at += sizeof(uint32_t) + length;
+                }
+                connection->in.erase(0, at);
+                alive = flush(connection);
+                if(at == 0 or !open) break;
+            }
+
+            /* A client that shut down its side still gets one try at its answers */
+            if(!alive or !open) drop(connection);
         }
-        counter++;
     }
-    state_diagram.nvertices = nvertices;
-    state_diagram.nedges = nedges;
-
-    dfa.setStateDiagram(state_diagram);
+}
 
-    return dfa;
+static void usage() {
+    std::cout<<"Invalid Input!"<<std::endl;
+    std::cout<<"Usage: "<<std::endl;
+    std::cout<<"./dfa <dfa_filename> <input_string>"<<std::endl;
+    std::cout<<"./dfa --scan [--uring] <dfa_filename> <path> [<path> ...]"<<std::endl;
+    std::cout<<"./dfa --profile <dfa_filename> <input_string>"<<std::endl;
+    std::cout<<"./dfa --lines [--count] [--profile | --watch] <dfa_filename> [<input_file>]"<<std::endl;
+    std::cout<<"./dfa --stream [--bits | --profile] [--checkpoint <file>] <dfa_filename> [<input_file>]"<<std::endl;
+    std::cout<<"./dfa --serve [--watch] [--cache <entries>] <socket_path> <dfa_filename> [<dfa_filename> ...]"<<std::endl;
 }
 
 int main(int argc, char** argv) {
     
     if(argc < 3) {
-        std::cout<<"Invalid Input!"<<std::endl;
-        std::cout<<"Usage: "<<std::endl;
-        std::cout<<"./dfa <dfa_filename> <input_string>"<<std::endl;
-        
+        usage();
+        return 1;
+    }
+
+    std::string mode = std::string(argv[1]);
+
+    if(mode == "--scan") {
+        int arg = 2;
+        bool use_uring = false;
+        if(std::string(argv[arg]) == "--uring") {
+            use_uring = true;
+            arg++;
+        }
+        if(arg + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        try {
+            return scan_main(argv[arg], std::vector<std::string>(argv + arg + 1, argv + argc), use_uring);
+        }
+        catch(const std::exception& e) {
+            std::cout<<"Error: "<<e.what()<<std::endl;
+            return 1;
+        }
+    }
+
+    if(mode == "--stream") {
+        int arg = 2;
+        std::string checkpoint_path;
+        bool packed = false;
+        bool profile = false;
+        if(arg < argc and std::string(argv[arg]) == "--bits") {
+            packed = true;
+            arg++;
+        }
+        else if(arg < argc and std::string(argv[arg]) == "--profile") {
+            profile = true;
+            arg++;
+        }
+        if(arg < argc and std::string(argv[arg]) == "--checkpoint") {
+            if(arg + 2 >= argc) {
+                usage();
+                return 1;
+            }
+            checkpoint_path = argv[arg + 1];
+            arg += 2;
+        }
+        try {
+            if(arg >= argc) {
+                usage();
+                return 1;
+            }
+            return stream_main(argv[arg], arg + 1 < argc ? argv[arg + 1] : "", checkpoint_path, packed, profile);
+        }
+        catch(const std::exception& e) {
+            std::cerr<<"Error: "<<e.what()<<std::endl;
+            return 2;
+        }
+    }
+
+    if(mode == "--serve") {
+        int arg = 2;
+        bool watch = false;
+        size_t cache_entries = 0;
+        if(std::string(argv[arg]) == "--watch") {
+            watch = true;
+            arg++;
+        }
+        if(arg + 1 < argc and std::string(argv[arg]) == "--cache") {
+            char* end;
+            cache_entries = size_t(strtoull(argv[arg + 1], &end, 10));
+            if(*end != '\0' or cache_entries == 0) {
+                usage();
+                return 1;
+            }
+            arg += 2;
+        }
+        if(arg + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        try {
+            return serve_main(argv[arg], std::vector<std::string>(argv + arg + 1, argv + argc), watch, cache_entries);
+        }
+        catch(const std::exception& e) {
+            std::cerr<<"Error: "<<e.what()<<std::endl;
+            return 1;
+        }
+    }
+
+    if(mode == "--lines") {
+        int arg = 2;
+        bool count_only = false, profile = false, watch = false;
+        for(; arg < argc; arg++) {
+            if(std::string(argv[arg]) == "--count") count_only = true;
+            else if(std::string(argv[arg]) == "--profile") profile = true;
+            else if(std::string(argv[arg]) == "--watch") watch = true;
+            else break;
+        }
+        if(arg >= argc or (profile and watch)) {
+            usage();
+            return 1;
+        }
+        try {
+            return lines_main(argv[arg], arg + 1 < argc ? argv[arg + 1] : "", count_only, profile, watch);
+        }
+        catch(const std::exception& e) {
+            std::cerr<<"Error: "<<e.what()<<std::endl;
+            return 1;
+        }
+    }
+
+    bool profile = mode == "--profile";
+    if(profile and argc < 4) {
+        usage();
         return 1;
     }
 
-    std::string dfa_filename = std::string(argv[1]);
-    std::string input_string = std::string(argv[2]);
+    std::string dfa_filename = std::string(argv[profile ? 2 : 1]);
+    std::string input_string = std::string(argv[profile ? 3 : 2]);
 
     std::cout<<"Building DFA from "<<dfa_filename<<std::endl;
-    auto dfa = build_dfa_from_file(dfa_filename);
+    DFA dfa;
+    try {
+        dfa = build_dfa_from_file(dfa_filename);
+    }
+    catch(const std::exception& e) {
+        std::cout<<"Error: "<<e.what()<<std::endl;
+        return 1;
+    }
 
-    auto evaluate = dfa.execute(input_string);
+    bool evaluate;
+    if(profile) {
+        auto automaton = std::move(dfa).freeze();
+        VisitCounters counters(automaton->getTable());
+        auto cursor = automaton->cursor();
+        cursor.feed(input_string.data(), input_string.size(), counters.recorder());
+        evaluate = cursor.accepted();
+
+        std::cout<<"Visits:"<<std::endl;
+        automaton->getStateDiagram().printHeatmap(counters.profile());
+    }
+    else {
+        evaluate = dfa.execute(input_string);
+    }
 
     std::cout<<"Input: "<<input_string<<std::endl;
     if(evaluate) {
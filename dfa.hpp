@@ -0,0 +1,3632 @@
+/*
+    Deterministic Finite Automaton
+        - arush15june 25/03/2019
+
+    State diagram, compiled execution engines and graph file loader.
+*/
+#ifndef DFA_HPP
+#define DFA_HPP
+
+#include <iostream>
+#include <array>
+#include <vector>
+#include <utility>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm> 
+#include <cctype>
+#include <locale>
+#include <cstring>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
+#include <tuple>
+#include <type_traits>
+
+#if defined(__x86_64__) or defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+
+struct VisitProfile {
+    /*
+        Merged visit counts of an instrumented run.
+
+        @param array<uint8_t, 256> classes: byte equivalence classes of the table
+        @param int nclasses: number of classes
+        @param vector<uint64_t> states: states[s] = bytes consumed while in state s
+        @param vector<uint64_t> transitions: transitions[s * nclasses + class] = times
+            state s consumed a byte of that class
+    */
+
+    std::array<uint8_t, 256> classes;
+    int nclasses = 0;
+    std::vector<uint64_t> states;
+    std::vector<uint64_t> transitions;
+
+    uint64_t visits(int state) const {
+        return size_t(state) < states.size() ? states[state] : 0;
+    }
+
+    uint64_t taken(int state, int weight) const {
+        /*
+            Count of the transition out of `state` on symbol `weight`. Bytes
+            of one equivalence class share a counter.
+        */
+
+        if(size_t(state) >= states.size() or weight < -128 or weight > 127) return 0;
+        return transitions[size_t(state) * nclasses + classes[static_cast<unsigned char>(weight)]];
+    }
+};
+
+struct EdgeRecord {
+    int state;
+    int weight;
+    int y;
+};
+
+struct RangeRecord {
+    int state;
+    uint32_t lo;
+    uint32_t hi;
+    int y;
+};
+
+struct EdgeBuffer {
+    /*
+        Edges collected for a StateDiagram, in insertion (file) order.
+
+        @param vector<EdgeRecord> edges: collected edges
+        @param vector<RangeRecord> ranges: collected code point range edges
+        @param int nvertices: adjacency list lines seen
+    */
+    std::vector<EdgeRecord> edges;
+    std::vector<RangeRecord> ranges;
+    int nvertices = 0;
+};
+
+static const uint32_t MAX_CODE_POINT = 0x10FFFF;
+
+inline int utf8_encode(uint32_t cp, uint8_t* out) {
+    /*
+        @return int length: number of bytes written to out (1 to 4)
+    */
+
+    if(cp < 0x80) {
+        out[0] = uint8_t(cp);
+        return 1;
+    }
+    if(cp < 0x800) {
+        out[0] = uint8_t(0xC0 | (cp >> 6));
+        out[1] = uint8_t(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if(cp < 0x10000) {
+        out[0] = uint8_t(0xE0 | (cp >> 12));
+        out[1] = uint8_t(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = uint8_t(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = uint8_t(0xF0 | (cp >> 18));
+    out[1] = uint8_t(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = uint8_t(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = uint8_t(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+typedef std::vector<std::pair<uint8_t, uint8_t>> ByteRangeSequence;
+
+inline void utf8_sequences(uint32_t lo, uint32_t hi, std::vector<ByteRangeSequence>& out) {
+    /*
+        Split the code points [lo, hi] into sequences of byte ranges whose
+        concatenations are exactly their UTF-8 encodings. Surrogates
+        (U+D800..U+DFFF) are left out. In every sequence, the ranges after
+        the first one that spans more than one byte are all [80, BF].
+    */
+
+    if(lo > hi) return;
+    if(lo <= 0xDFFF and hi >= 0xD800) {
+        if(lo < 0xD800) utf8_sequences(lo, 0xD7FF, out);
+        if(hi > 0xDFFF) utf8_sequences(0xE000, hi, out);
+        return;
+    }
+    for(uint32_t boundary: {0x7Fu, 0x7FFu, 0xFFFFu}) {
+        if(lo <= boundary and hi > boundary) {
+            utf8_sequences(lo, boundary, out);
+            utf8_sequences(boundary + 1, hi, out);
+            return;
+        }
+    }
+
+    uint8_t first[4], last[4];
+    auto length = utf8_encode(lo, first);
+    utf8_encode(hi, last);
+    for(auto i = 1; i < length; i++) {
+        uint32_t mask = (1u << (6 * i)) - 1;
+        if((lo & ~mask) == (hi & ~mask)) continue;
+        if(lo & mask) {
+            utf8_sequences(lo, lo | mask, out);
+            utf8_sequences((lo | mask) + 1, hi, out);
+            return;
+        }
+        if((hi & mask) != mask) {
+            utf8_sequences(lo, (hi & ~mask) - 1, out);
+            utf8_sequences(hi & ~mask, hi, out);
+            return;
+        }
+    }
+
+    ByteRangeSequence sequence;
+    for(auto i = 0; i < length; i++) sequence.emplace_back(first[i], last[i]);
+    out.push_back(sequence);
+}
+
+struct EdgeRange {
+    /*
+        Non-owning view of one state's adjacency list inside a StateDiagram.
+    */
+
+    const std::pair<int, int>* first;
+    const std::pair<int, int>* last;
+
+    const std::pair<int, int>* begin() const { return first; }
+    const std::pair<int, int>* end() const { return last; }
+    size_t size() const { return size_t(last - first); }
+    bool empty() const { return first == last; }
+    const std::pair<int, int>& operator[](size_t i) const { return first[i]; }
+};
+
+static const int ANY_SYMBOL = 256;
+
+struct StateDiagram {
+    /*
+        State diagram as an edge weight undirected graph, frozen in
+        compressed sparse row layout. Built with StateDiagramBuilder.
+
+        @param vector<int> offsets: adjacency list of state s is
+            edges[offsets[s], offsets[s+1]); one row per state number 0..max state
+        @param vector< pair<int, int> > edges: all adjacency lists back to back,
+            every list sorted by weight (stable, so equal weights keep file order)
+            pair.first => edge weight used as input director, -1 if none
+                Edge Weight in ASCII represents string to select.
+                ANY_SYMBOL (256) is taken on every byte that has no edge of
+                its own in the list; it sorts last.
+            pair.second => state no, -1 if first state
+        @param int nvertices: number of vertices
+        @param int nedges: number of edges
+    */
+
+    std::vector<int> offsets {0};
+    std::vector<std::pair<int, int>> edges;
+    int nvertices;
+    int nedges;
+
+    StateDiagram() {
+        nvertices = 0;
+        nedges = 0;
+    }
+
+    int nstates() const {
+        /*
+            @return int n: number of rows, i.e. max state number + 1
+        */
+
+        return int(offsets.size()) - 1;
+    }
+
+    EdgeRange getState(int index) const {
+        /*
+            get the adjacency list of a certain state
+
+            @param int index: state no
+            @return EdgeRange adjList: adjacency list of state `index`, empty
+                if the state has no row
+        */
+
+        if(index < 0 or index >= nstates()) return EdgeRange{nullptr, nullptr};
+        auto base = edges.data();
+        return EdgeRange{base + offsets[index], base + offsets[index + 1]};
+    }
+
+    int lastState() const {
+        /*
+            @return int n: highest state number to list, at least nvertices
+        */
+
+        return std::max(nvertices, nstates() - 1);
+    }
+
+    int degree(int index) const {
+        /*
+            @return int degree: outdegree of state `index`
+        */
+
+        return int(getState(index).size());
+    }
+
+    void printList() const {
+        for(auto i = 1; i <= lastState(); i++) {
+            auto adjList = getState(i);
+            std::cout<<i<<": ";
+            for (auto pair: adjList) {
+                std::cout<<pair.first<<" "<<pair.second<<" ";
+            }
+            std::cout<<std::endl;
+        }
+    }
+
+    void printHeatmap(const VisitProfile& profile, std::ostream& out = std::cout) const {
+        /*
+            printList annotated with visit counts, one entry per byte class:
+                <state>: <visits> | <weight>[,<weight>...] <state> <count> | ...
+            Edges whose bytes share an equivalence class share one counter,
+            so they are printed together; 256 (ANY_SYMBOL) is listed when
+            bytes without an edge of their own fall into the class.
+        */
+
+        struct Group {
+            int cls;
+            int representative;
+            std::vector<int> weights;
+            int y;
+        };
+
+        for(auto i = 1; i <= lastState(); i++) {
+            std::vector<Group> groups;
+            auto add = [&](int byte, int weight, int y) {
+                int cls = profile.classes[static_cast<unsigned char>(byte)];
+                for(auto &group: groups) {
+                    if(group.cls != cls) continue;
+                    if(std::find(group.weights.begin(), group.weights.end(), weight) == group.weights.end()) group.weights.push_back(weight);
+                    return;
+                }
+                groups.push_back(Group{cls, byte, {weight}, y});
+            };
+
+            std::array<bool, 256> mentioned {};
+            for(auto pair: getState(i)) {
+                if(pair.first >= -128 and pair.first <= 127) mentioned[static_cast<unsigned char>(pair.first)] = true;
+            }
+            for(auto pair: getState(i)) {
+                if(pair.first != ANY_SYMBOL) {
+                    add(pair.first, pair.first, pair.second);
+                    continue;
+                }
+                for(auto byte = 0; byte < 256; byte++) {
+                    if(!mentioned[byte]) add(static_cast<signed char>(byte), ANY_SYMBOL, pair.second);
+                }
+            }
+
+            /* Classes reached only through ANY_SYMBOL are one edge: print their sum once */
+            uint64_t any_count = 0;
+            for(auto &group: groups) {
+                if(group.weights.size() == 1 and group.weights[0] == ANY_SYMBOL) any_count += profile.taken(i, group.representative);
+            }
+
+            out<<i<<": "<<profile.visits(i);
+            bool any_printed = false;
+            for(auto &group: groups) {
+                bool any_only = group.weights.size() == 1 and group.weights[0] == ANY_SYMBOL;
+                if(any_only and any_printed) continue;
+                out<<" | ";
+                for(size_t k = 0; k < group.weights.size(); k++) out<<(k ? "," : "")<<group.weights[k];
+                out<<" "<<group.y<<" "<<(any_only ? any_count : profile.taken(i, group.representative));
+                any_printed = any_printed or any_only;
+            }
+            out<<std::endl;
+        }
+    }
+};
+
+class StateDiagramBuilder {
+    /*
+        Collects edges in any order and freezes them into a StateDiagram.
+
+        Usage:
+            StateDiagramBuilder builder;
+            builder.insertEdge(1, 48, 2);
+            builder.addVertex();
+            StateDiagram diagram = builder.finalize();
+
+        The graph file loader hands over one EdgeBuffer per parser thread
+        instead; buffers are concatenated in order.
+    */
+
+    std::vector<EdgeBuffer> buffers;
+
+public:
+    StateDiagramBuilder() : buffers(1) {}
+    explicit StateDiagramBuilder(std::vector<EdgeBuffer> parts) : buffers(std::move(parts)) {
+        if(buffers.empty()) buffers.resize(1);
+    }
+
+    void insertEdge(int state_no, int weight, int y) {
+        /*
+            Add edge to an adjacency list.
+
+            @param int state_no: state to add to
+            @param int weight: weight of edge
+            @param int y: state no of edge
+        */
+
+        buffers.back().edges.push_back(EdgeRecord{state_no, weight, y});
+    }
+
+    void insertRange(int state_no, uint32_t lo, uint32_t hi, int y) {
+        /*
+            Add an edge taken on every Unicode code point in [lo, hi].
+
+            finalize() compiles it into byte edges over the UTF-8 encoding,
+            through new intermediate states, so execution stays one lookup
+            per byte. Byte edges of state_no take precedence over ranges on
+            the same lead byte, and earlier ranges over later ones. A code
+            point that leaves the ranges midway behaves like a byte without
+            an edge: back to state_no, or its ANY_SYMBOL target.
+
+            @param int state_no: state to add to
+            @param uint32_t lo: first code point
+            @param uint32_t hi: last code point
+            @param int y: state no of edge
+        */
+
+        if(lo > hi or hi > MAX_CODE_POINT) throw std::out_of_range("StateDiagramBuilder: bad code point range");
+        buffers.back().ranges.push_back(RangeRecord{state_no, lo, hi, y});
+    }
+
+    void addVertex() {
+        /*
+            Count one adjacency list (StateDiagram::nvertices).
+        */
+
+        buffers.back().nvertices += 1;
+    }
+
+    StateDiagram finalize(int max_reserved = 0) {
+        /*
+            Freeze the collected edges in one pass: count edges per state,
+            prefix sum, scatter in insertion order, then sort every row by
+            weight. The builder is left empty.
+
+            @param int max_reserved: largest state in use without edges of
+                its own (such as q and f); states created for code point
+                ranges are numbered above it
+            @return StateDiagram diagram
+        */
+
+        expandRanges(max_reserved);
+
+        int max_state = 0;
+        size_t nedges = 0;
+        int nvertices = 0;
+        for(auto &buffer: buffers) {
+            nvertices += buffer.nvertices;
+            nedges += buffer.edges.size();
+            for(auto &edge: buffer.edges) {
+                if(edge.state < 0 or edge.y < 0) {
+                    throw std::out_of_range("StateDiagramBuilder: negative state number");
+                }
+                max_state = std::max(max_state, std::max(edge.state, edge.y));
+            }
+        }
+        if(nedges > size_t(0x7fffffff)) throw std::out_of_range("StateDiagramBuilder: too many edges");
+
+        StateDiagram diagram;
+        diagram.nvertices = nvertices;
+        diagram.nedges = int(nedges);
+        diagram.offsets.assign(size_t(max_state) + 2, 0);
+        for(auto &buffer: buffers) {
+            for(auto &edge: buffer.edges) diagram.offsets[edge.state + 1] += 1;
+        }
+        for(size_t i = 1; i < diagram.offsets.size(); i++) diagram.offsets[i] += diagram.offsets[i-1];
+
+        diagram.edges.resize(nedges);
+        std::vector<int> cursor(diagram.offsets.begin(), diagram.offsets.end() - 1);
+        for(auto &buffer: buffers) {
+            for(auto &edge: buffer.edges) {
+                diagram.edges[cursor[edge.state]++] = std::make_pair(edge.weight, edge.y);
+            }
+            std::vector<EdgeRecord>().swap(buffer.edges);
+        }
+        buffers.assign(1, EdgeBuffer());
+
+        auto by_weight = [](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+            return a.first < b.first;
+        };
+        for(auto state = 0; state < diagram.nstates(); state++) {
+            auto first = diagram.edges.begin() + diagram.offsets[state];
+            auto last = diagram.edges.begin() + diagram.offsets[state + 1];
+            if(!std::is_sorted(first, last, by_weight)) std::stable_sort(first, last, by_weight);
+        }
+
+        return diagram;
+    }
+
+private:
+    void expandRanges(int max_reserved) {
+        /*
+            Replace all code point ranges by byte edges. Ranges of one state
+            are made disjoint (first wins) and split into UTF-8 byte range
+            sequences; sequences sharing a prefix share its intermediate
+            states, which are numbered after the largest state in use.
+        */
+
+        std::vector<RangeRecord> ranges;
+        int max_state = std::max(0, max_reserved);
+        for(auto &buffer: buffers) {
+            for(auto &range: buffer.ranges) {
+                if(range.state < 0 or range.y < 0) throw std::out_of_range("StateDiagramBuilder: negative state number");
+                max_state = std::max(max_state, std::max(range.state, range.y));
+            }
+            ranges.insert(ranges.end(), buffer.ranges.begin(), buffer.ranges.end());
+            std::vector<RangeRecord>().swap(buffer.ranges);
+        }
+        if(ranges.empty()) return;
+        for(auto &buffer: buffers) {
+            for(auto &edge: buffer.edges) max_state = std::max(max_state, std::max(edge.state, edge.y));
+        }
+
+        std::vector<int> fallback(size_t(max_state) + 1, -1);
+        for(auto &buffer: buffers) {
+            for(auto &edge: buffer.edges) {
+                if(edge.weight == ANY_SYMBOL and edge.y != edge.state and fallback[edge.state] == -1) fallback[edge.state] = edge.y;
+            }
+        }
+
+        std::stable_sort(ranges.begin(), ranges.end(), [](const RangeRecord& a, const RangeRecord& b) {
+            return a.state < b.state;
+        });
+
+        auto &out = buffers.back();
+        int fresh = max_state + 1;
+        std::vector<ByteRangeSequence> sequences;
+        for(size_t first = 0; first < ranges.size();) {
+            auto source = ranges[first].state;
+            auto miss = fallback[source] == -1 ? source : fallback[source];
+            size_t last = first;
+            while(last < ranges.size() and ranges[last].state == source) last++;
+
+            /* Disjoint pieces in insertion order; covered is kept sorted */
+            std::vector<std::pair<uint32_t, uint32_t>> covered;
+            std::vector<RangeRecord> pieces;
+            for(auto k = first; k < last; k++) {
+                auto lo = ranges[k].lo, hi = ranges[k].hi;
+                for(auto &c: covered) {
+                    if(c.second < lo) continue;
+                    if(c.first > hi) break;
+                    if(c.first > lo) pieces.push_back(RangeRecord{source, lo, c.first - 1, ranges[k].y});
+                    lo = c.second + 1;
+                    if(lo > hi) break;
+                }
+                if(lo <= hi) pieces.push_back(RangeRecord{source, lo, hi, ranges[k].y});
+
+                covered.emplace_back(ranges[k].lo, ranges[k].hi);
+                std::sort(covered.begin(), covered.end());
+                std::vector<std::pair<uint32_t, uint32_t>> merged;
+                for(auto &c: covered) {
+                    if(!merged.empty() and c.first <= merged.back().second + 1) merged.back().second = std::max(merged.back().second, c.second);
+                    else merged.push_back(c);
+                }
+                covered.swap(merged);
+            }
+
+            std::map<std::tuple<int, uint8_t, uint8_t>, int> children;
+            for(auto &piece: pieces) {
+                sequences.clear();
+                utf8_sequences(piece.lo, piece.hi, sequences);
+                for(auto &sequence: sequences) {
+                    int current = source;
+                    for(size_t k = 0; k < sequence.size(); k++) {
+                        auto lo_byte = sequence[k].first, hi_byte = sequence[k].second;
+                        int next = piece.y;
+                        if(k + 1 < sequence.size()) {
+                            auto key = std::make_tuple(current, lo_byte, hi_byte);
+                            auto found = children.find(key);
+                            if(found != children.end()) {
+                                current = found->second;
+                                continue;
+                            }
+                            next = fresh++;
+                            children.emplace(key, next);
+                            out.edges.push_back(EdgeRecord{next, ANY_SYMBOL, miss});
+                            out.nvertices += 1;
+                        }
+                        for(int byte = lo_byte; byte <= hi_byte; byte++) {
+                            out.edges.push_back(EdgeRecord{current, static_cast<signed char>(byte), next});
+                        }
+                        current = next;
+                    }
+                }
+            }
+
+            first = last;
+        }
+    }
+};
+
+struct TransitionTable {
+    /*
+        Dense transition table compiled from a StateDiagram.
+
+        Input bytes are first mapped to equivalence classes (bytes that lead
+        every state to the same next state share a class), so the table only
+        needs one column per class. Missing edges keep the current state,
+        exactly like DFA::execute.
+
+        @param array<uint8_t, 256> classes: equivalence class of every byte
+        @param int nclasses: number of equivalence classes
+        @param int nstates: number of rows, one per state number 0..max state
+        @param int q: initial state
+        @param int f: final state, -1 if no input is accepted
+        @param vector<int32_t> next: next[state * nclasses + class]
+        @param uint64_t fingerprint: hash of all of the above, identifies the
+            automaton in checkpoints
+    */
+
+    std::array<uint8_t, 256> classes;
+    int nclasses;
+    int nstates;
+    int q;
+    int f;
+    std::vector<int32_t> next;
+    uint64_t fingerprint;
+
+    TransitionTable(const StateDiagram& diagram, int init_state, int final_state) : q{init_state}, f{final_state} {
+        if(init_state < 0 or final_state < -1) throw std::out_of_range("TransitionTable: negative initial or final state");
+        nstates = std::max(std::max(init_state, final_state) + 1, diagram.nstates());
+
+        /*  Refine byte classes state by state: bytes of a class are split
+            apart whenever some state sends them to different targets. */
+        std::array<int, 256> target;
+        std::array<int, 256> byte_class;
+        std::vector<int> touched;
+        target.fill(-1);
+        byte_class.fill(0);
+        int next_class = 1;
+
+        std::array<bool, 256> mentioned {};
+        auto effective_edges = [&](int state) {
+            touched.clear();
+            auto row = diagram.getState(state);
+            int any = -1;
+            for(auto &pair: row) {
+                if(pair.first == ANY_SYMBOL and pair.second != state and any == -1) any = pair.second;
+                if(pair.first < -128 or pair.first > 127) continue;
+                auto byte = static_cast<unsigned char>(pair.first);
+                mentioned[byte] = true;
+                if(pair.second == state or target[byte] != -1) continue;
+                target[byte] = pair.second;
+                touched.push_back(byte);
+            }
+            for(auto byte = 0; byte < 256 and any != -1; byte++) {
+                if(mentioned[byte]) continue;
+                target[byte] = any;
+                touched.push_back(byte);
+            }
+            for(auto &pair: row) {
+                if(pair.first >= -128 and pair.first <= 127) mentioned[static_cast<unsigned char>(pair.first)] = false;
+            }
+        };
+
+        std::vector<std::array<int, 3>> splits;
+        for(auto i = 0; i < diagram.nstates(); i++) {
+            if(diagram.degree(i) == 0) continue;
+            effective_edges(i);
+
+            splits.clear();
+            for(auto byte: touched) {
+                auto key_class = byte_class[byte], key_target = target[byte];
+                auto split = std::find_if(splits.begin(), splits.end(), [&](const std::array<int, 3>& s) {
+                    return s[0] == key_class and s[1] == key_target;
+                });
+                if(split == splits.end()) {
+                    splits.push_back({key_class, key_target, next_class++});
+                    split = splits.end() - 1;
+                }
+                target[byte] = -1;
+                byte_class[byte] = (*split)[2];
+            }
+
+            if(next_class > 4096) next_class = compact_classes(byte_class);
+        }
+        nclasses = compact_classes(byte_class);
+        for(auto byte = 0; byte < 256; byte++) classes[byte] = uint8_t(byte_class[byte]);
+
+        next.resize(size_t(nstates) * nclasses);
+        for(auto state = 0; state < nstates; state++) {
+            std::fill_n(next.begin() + size_t(state) * nclasses, nclasses, state);
+        }
+        for(auto i = 0; i < diagram.nstates(); i++) {
+            if(diagram.degree(i) == 0) continue;
+            effective_edges(i);
+            for(auto byte: touched) {
+                next[size_t(i) * nclasses + classes[byte]] = target[byte];
+                target[byte] = -1;
+            }
+        }
+
+        /* FNV-1a over the whole table */
+        fingerprint = 0xcbf29ce484222325ULL;
+        auto hash = [&](const void* data, size_t length) {
+            auto bytes = static_cast<const unsigned char*>(data);
+            for(size_t i = 0; i < length; i++) fingerprint = (fingerprint ^ bytes[i]) * 0x100000001b3ULL;
+        };
+        int32_t header[] = {nclasses, nstates, q, f};
+        hash(header, sizeof(header));
+        hash(classes.data(), classes.size());
+        hash(next.data(), next.size() * sizeof(int32_t));
+    }
+
+    int32_t step(int32_t state, unsigned char symbol) const {
+        return next[size_t(state) * nclasses + classes[symbol]];
+    }
+
+private:
+    static int compact_classes(std::array<int, 256>& byte_class) {
+        /*
+            Renumber classes 0..n-1 in order of their first byte.
+
+            @return int n: number of classes
+        */
+
+        std::vector<int> seen;
+        for(auto &cls: byte_class) {
+            auto it = std::find(seen.begin(), seen.end(), cls);
+            if(it == seen.end()) {
+                seen.push_back(cls);
+                cls = int(seen.size()) - 1;
+            }
+            else {
+                cls = int(it - seen.begin());
+            }
+        }
+        return int(seen.size());
+    }
+};
+
+inline size_t l2_cache_bytes() {
+    /*
+        Per-core L2 size as reported by the C library, 256 KiB if unknown.
+    */
+
+    static const size_t bytes = [] {
+        long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        return size > 0 ? size_t(size) : size_t(256) << 10;
+    }();
+    return bytes;
+}
+
+struct StrideTable {
+    /*
+        Two-byte transition table over a TransitionTable: one lookup per
+        pair of input bytes, halving the chain of dependent loads.
+
+        Indexed by state and class pair, so it has nclasses^2 columns; it
+        only pays off while it stays in cache (see fits()).
+
+        @param int nclasses: classes of the base table
+        @param vector<int32_t> next: next[state * nclasses^2 + c1 * nclasses + c2]
+    */
+
+    int nclasses;
+    std::vector<int32_t> next;
+
+    explicit StrideTable(const TransitionTable& table) : nclasses{table.nclasses} {
+        size_t width = size_t(nclasses) * nclasses;
+        next.resize(size_t(table.nstates) * width);
+        for(auto state = 0; state < table.nstates; state++) {
+            auto row = table.next.data() + size_t(state) * nclasses;
+            auto out = next.data() + size_t(state) * width;
+            for(auto c1 = 0; c1 < nclasses; c1++) {
+                auto middle = table.next.data() + size_t(row[c1]) * nclasses;
+                std::copy_n(middle, nclasses, out + size_t(c1) * nclasses);
+            }
+        }
+    }
+
+    static size_t bytesFor(const TransitionTable& table) {
+        return size_t(table.nstates) * table.nclasses * table.nclasses * sizeof(int32_t);
+    }
+
+    static bool fits(const TransitionTable& table) {
+        /*
+            Worth building: more than one class, and at most half of L2 so
+            the input and the rest of the working set keep the other half.
+        */
+
+        return table.nclasses > 1 and bytesFor(table) <= l2_cache_bytes() / 2;
+    }
+};
+
+struct BitTable {
+    /*
+        Transition table for bit-packed input over a two-symbol alphabet:
+        every packed byte carries eight symbols, bit 0 standing for symbol
+        `zero` and bit 1 for `one`, and advances the automaton by all eight
+        in one lookup.
+
+        @param array<int32_t, 2> column: class of the symbol of each bit value
+        @param bool msb_first: the first symbol of a byte is its high bit
+        @param vector<int32_t> next: next[state * 256 + byte] = state after the byte's 8 symbols
+    */
+
+    std::array<int32_t, 2> column;
+    bool msb_first;
+    std::vector<int32_t> next;
+
+    explicit BitTable(const TransitionTable& table, char zero = '0', char one = '1', bool msb = true) : msb_first{msb} {
+        column[0] = table.classes[static_cast<unsigned char>(zero)];
+        column[1] = table.classes[static_cast<unsigned char>(one)];
+
+        next.resize(size_t(table.nstates) * 256);
+        for(auto state = 0; state < table.nstates; state++) {
+            for(auto byte = 0; byte < 256; byte++) {
+                next[size_t(state) * 256 + byte] = stepBits(table, state, uint8_t(byte), 8);
+            }
+        }
+    }
+
+    int bit(uint8_t byte, int k) const {
+        /*
+            @return int bit: k-th symbol (0 = first) of a packed byte
+        */
+
+        return msb_first ? (byte >> (7 - k)) & 1 : (byte >> k) & 1;
+    }
+
+    int32_t stepBits(const TransitionTable& table, int32_t state, uint8_t byte, int nbits) const {
+        /*
+            Advance by the first `nbits` symbols of a packed byte.
+        */
+
+        for(auto k = 0; k < nbits; k++) {
+            state = table.next[size_t(state) * table.nclasses + column[bit(byte, k)]];
+        }
+        return state;
+    }
+};
+
+static const size_t MAX_PREFILTER_CELLS = 1 << 20;
+static const size_t MAX_PREFILTER_WORK = size_t(1) << 26;
+static const size_t MAX_LITERAL_BYTES = 16;
+static const size_t MAX_PREFILTER_BYTES = 4;
+
+class Prefilter {
+    /*
+        Necessary condition for acceptance extracted from a TransitionTable:
+        a literal that every accepted input contains or, when there is
+        none, a few bytes of which every accepted input contains one.
+        mayMatch looks for it at memchr speed (AVX2 when available), so
+        inputs without it are rejected without running the DFA; inputs that
+        have it must still be run. Only valid for whole inputs run from q.
+
+        A literal L is required when no input that avoids L leads from q
+        to f, i.e. f is unreachable in the product of the table with the
+        KMP automaton of L. Literals are grown byte by byte on either side
+        from required single bytes, keeping the longest. Tables over
+        MAX_PREFILTER_CELLS cells get no prefilter and extraction gives up
+        (keeping what it has) after MAX_PREFILTER_WORK steps.
+
+        @param string literal: required literal, empty if none
+        @param vector<uint8_t> bytes: required byte set, empty if none (or a literal was found)
+    */
+
+    std::string literal;
+    std::vector<uint8_t> bytes;
+
+    static bool avoidable(const TransitionTable& table, const std::string& needle, size_t& work) {
+        /*
+            @return bool avoidable: some input without `needle` is accepted
+                (also true once the work budget is spent)
+        */
+
+        auto m = needle.size();
+        std::vector<size_t> fail(m + 1, 0);
+        for(size_t k = 1, j = 0; k < m; k++) {
+            while(j and needle[k] != needle[j]) j = fail[j];
+            if(needle[k] == needle[j]) j++;
+            fail[k + 1] = j;
+        }
+        auto advance = [&](size_t k, char c) {
+            while(k and needle[k] != c) k = fail[k];
+            return needle[k] == c ? k + 1 : 0;
+        };
+
+        /* Bytes outside the needle reset the KMP state, so they only matter per class */
+        std::array<bool, 256> in_needle {};
+        std::vector<uint8_t> distinct;
+        for(char c: needle) {
+            auto byte = static_cast<uint8_t>(c);
+            if(!in_needle[byte]) distinct.push_back(byte);
+            in_needle[byte] = true;
+        }
+        std::vector<uint8_t> other(size_t(table.nclasses), 0);
+        for(auto byte = 0; byte < 256; byte++) {
+            if(!in_needle[byte]) other[table.classes[byte]] = 1;
+        }
+
+        size_t nclasses = size_t(table.nclasses);
+        std::vector<uint8_t> seen(size_t(table.nstates) * m, 0);
+        std::vector<size_t> stack {size_t(table.q) * m};
+        seen[stack.back()] = 1;
+        auto visit = [&](int32_t state, size_t k) {
+            auto id = size_t(state) * m + k;
+            if(seen[id]) return;
+            seen[id] = 1;
+            stack.push_back(id);
+        };
+
+        while(!stack.empty()) {
+            auto id = stack.back();
+            stack.pop_back();
+            auto state = int32_t(id / m);
+            auto k = id % m;
+            if(state == table.f) return true;
+            if(work < nclasses + distinct.size()) return true;
+            work -= nclasses + distinct.size();
+
+            auto row = table.next.data() + size_t(state) * nclasses;
+            for(size_t c = 0; c < nclasses; c++) {
+                if(other[c]) visit(row[c], 0);
+            }
+            for(auto byte: distinct) {
+                auto next_k = advance(k, char(byte));
+                if(next_k < m) visit(row[table.classes[byte]], next_k);
+            }
+        }
+        return false;
+    }
+
+    static bool avoidable(const TransitionTable& table, const std::vector<uint8_t>& banned) {
+        /*
+            @return bool avoidable: some input without bytes of the banned classes is accepted
+        */
+
+        size_t nclasses = size_t(table.nclasses);
+        std::vector<uint8_t> seen(size_t(table.nstates), 0);
+        std::vector<int32_t> stack {table.q};
+        seen[size_t(table.q)] = 1;
+        while(!stack.empty()) {
+            auto state = stack.back();
+            stack.pop_back();
+            if(state == table.f) return true;
+            auto row = table.next.data() + size_t(state) * nclasses;
+            for(size_t c = 0; c < nclasses; c++) {
+                if(banned[c] or seen[size_t(row[c])]) continue;
+                seen[size_t(row[c])] = 1;
+                stack.push_back(row[c]);
+            }
+        }
+        return false;
+    }
+
+    static bool findLiteral(const char* data, size_t length, const std::string& needle) {
+        if(needle.size() == 1) return memchr(data, needle[0], length) != nullptr;
+#if defined(__x86_64__) or defined(__i386__)
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if(avx2) return findLiteralAVX2(data, length, needle);
+#endif
+        return std::search(data, data + length, needle.begin(), needle.end()) != data + length;
+    }
+
+    static bool findBytes(const char* data, size_t length, const std::vector<uint8_t>& set) {
+        if(set.size() == 1) return memchr(data, set[0], length) != nullptr;
+        size_t i = 0;
+#if defined(__x86_64__) or defined(__i386__)
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if(avx2 and findBytesAVX2(data, length, set, i)) return true;
+#endif
+        std::array<bool, 256> member {};
+        for(auto byte: set) member[byte] = true;
+        for(; i < length; i++) {
+            if(member[static_cast<uint8_t>(data[i])]) return true;
+        }
+        return false;
+    }
+
+#if defined(__x86_64__) or defined(__i386__)
+    __attribute__((target("avx2")))
+    static bool findLiteralAVX2(const char* data, size_t length, const std::string& needle) {
+        /* Candidates where the first and last byte match, verified with memcmp */
+        auto m = needle.size();
+        if(length < m) return false;
+        auto first = _mm256_set1_epi8(needle[0]);
+        auto last = _mm256_set1_epi8(needle[m - 1]);
+        size_t i = 0;
+        for(; i + m - 1 + 32 <= length; i += 32) {
+            auto head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            auto tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + m - 1));
+            auto mask = uint32_t(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last))));
+            while(mask) {
+                auto at = i + size_t(__builtin_ctz(mask));
+                if(memcmp(data + at + 1, needle.data() + 1, m - 2) == 0) return true;
+                mask &= mask - 1;
+            }
+        }
+        return std::search(data + i, data + length, needle.begin(), needle.end()) != data + length;
+    }
+
+    __attribute__((target("avx2")))
+    static bool findBytesAVX2(const char* data, size_t length, const std::vector<uint8_t>& set, size_t& i) {
+        /*
+            Whole 32 byte blocks only; i is set to where the scalar tail starts.
+        */
+
+        __m256i wanted[MAX_PREFILTER_BYTES];
+        for(size_t k = 0; k < set.size(); k++) wanted[k] = _mm256_set1_epi8(char(set[k]));
+        for(i = 0; i + 32 <= length; i += 32) {
+            auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            auto hit = _mm256_cmpeq_epi8(block, wanted[0]);
+            for(size_t k = 1; k < set.size(); k++) hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(block, wanted[k]));
+            if(_mm256_movemask_epi8(hit)) return true;
+        }
+        return false;
+    }
+#endif
+
+public:
+    Prefilter() {}
+
+    explicit Prefilter(const TransitionTable& table) {
+        size_t nclasses = size_t(table.nclasses);
+        if(size_t(table.nstates) * nclasses > MAX_PREFILTER_CELLS) return;
+        if(table.f < 0 or table.f >= table.nstates) return;
+        if(!avoidable(table, std::vector<uint8_t>(nclasses, 0))) return;
+
+        /* A byte sharing its class with others can always be swapped for them */
+        std::vector<int> class_size(nclasses, 0);
+        for(auto byte = 0; byte < 256; byte++) class_size[table.classes[byte]]++;
+        std::vector<char> singles;
+        for(auto byte = 0; byte < 256; byte++) {
+            if(class_size[table.classes[byte]] == 1) singles.push_back(char(byte));
+        }
+
+        size_t work = MAX_PREFILTER_WORK;
+        for(auto c: singles) {
+            std::string grown(1, c);
+            if(avoidable(table, grown, work)) continue;
+            for(bool extended = true; extended and grown.size() < MAX_LITERAL_BYTES;) {
+                extended = false;
+                for(auto d: singles) {
+                    if(!avoidable(table, grown + d, work)) {
+                        grown += d;
+                        extended = true;
+                        break;
+                    }
+                    if(!avoidable(table, d + grown, work)) {
+                        grown.insert(grown.begin(), d);
+                        extended = true;
+                        break;
+                    }
+                }
+            }
+            if(grown.size() > literal.size()) literal = grown;
+        }
+        if(!literal.empty()) return;
+
+        /* Largest classes first: drop every class whose bytes are not needed to cut q from f */
+        std::vector<size_t> order(nclasses);
+        for(size_t c = 0; c < nclasses; c++) order[c] = c;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return class_size[a] > class_size[b];
+        });
+        std::vector<uint8_t> banned(nclasses, 1);
+        for(auto c: order) {
+            banned[c] = 0;
+            if(avoidable(table, banned)) banned[c] = 1;
+        }
+        for(auto byte = 0; byte < 256; byte++) {
+            if(banned[table.classes[byte]]) bytes.push_back(uint8_t(byte));
+        }
+        if(bytes.size() > MAX_PREFILTER_BYTES) bytes.clear();
+    }
+
+    const std::string& getLiteral() const {
+        return literal;
+    }
+
+    const std::vector<uint8_t>& getBytes() const {
+        return bytes;
+    }
+
+    bool active() const {
+        return !literal.empty() or !bytes.empty();
+    }
+
+    bool mayMatch(const char* data, size_t length) const {
+        /*
+            @return bool may_match: false if data cannot be accepted
+        */
+
+        if(!literal.empty()) return findLiteral(data, length, literal);
+        if(!bytes.empty()) return findBytes(data, length, bytes);
+        return true;
+    }
+};
+
+struct NoInstrumentation {
+    /*
+        Default instrumentation policy of the execution engines: does
+        nothing and compiles away completely.
+    */
+
+    void visit(int32_t, size_t) {}
+};
+
+class VisitCounters {
+    /*
+        Per-thread state and transition visit counters.
+
+        Every thread records into its own counter block through a Recorder,
+        so counting needs no atomic read-modify-write; profile() merges all
+        blocks on demand, also while threads are still recording.
+
+        Usage:
+            VisitCounters counters(table);
+            cursor.feed(data, length, counters.recorder());  // on each thread
+            dfa.getStateDiagram().printHeatmap(counters.profile());
+    */
+
+    struct Block {
+        std::vector<uint64_t> states;
+        std::vector<uint64_t> transitions;
+    };
+
+    std::array<uint8_t, 256> classes;
+    int nclasses;
+    int nstates;
+    std::mutex lock;
+    std::vector<std::pair<std::thread::id, std::unique_ptr<Block>>> blocks;
+
+    static void bump(uint64_t& counter) {
+        __atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+    }
+
+public:
+    class Recorder {
+        friend class VisitCounters;
+
+        Block* block;
+        size_t nclasses;
+
+    public:
+        Recorder(Block* b, size_t n) : block{b}, nclasses{n} {}
+
+        void visit(int32_t state, size_t column) {
+            bump(block->states[state]);
+            bump(block->transitions[size_t(state) * nclasses + column]);
+        }
+    };
+
+    explicit VisitCounters(const TransitionTable& table) : classes(table.classes), nclasses{table.nclasses}, nstates{table.nstates} {}
+
+    Recorder recorder() {
+        /*
+            Recorder for the calling thread's counter block.
+        */
+
+        std::lock_guard<std::mutex> guard(lock);
+        auto self = std::this_thread::get_id();
+        for(auto &entry: blocks) {
+            if(entry.first == self) return Recorder(entry.second.get(), size_t(nclasses));
+        }
+
+        std::unique_ptr<Block> block(new Block);
+        block->states.assign(nstates, 0);
+        block->transitions.assign(size_t(nstates) * nclasses, 0);
+        blocks.emplace_back(self, std::move(block));
+        return Recorder(blocks.back().second.get(), size_t(nclasses));
+    }
+
+    VisitProfile profile() {
+        /*
+            Sum of all threads' counters.
+        */
+
+        VisitProfile merged;
+        merged.classes = classes;
+        merged.nclasses = nclasses;
+        merged.states.assign(nstates, 0);
+        merged.transitions.assign(size_t(nstates) * nclasses, 0);
+
+        std::lock_guard<std::mutex> guard(lock);
+        for(auto &entry: blocks) {
+            auto &block = *entry.second;
+            for(size_t i = 0; i < merged.states.size(); i++) {
+                merged.states[i] += __atomic_load_n(&block.states[i], __ATOMIC_RELAXED);
+            }
+            for(size_t i = 0; i < merged.transitions.size(); i++) {
+                merged.transitions[i] += __atomic_load_n(&block.transitions[i], __ATOMIC_RELAXED);
+            }
+        }
+        return merged;
+    }
+
+    void add(const VisitProfile& counts) {
+        /*
+            Add counts of the same table (e.g. from a checkpoint) to the
+            calling thread's counter block.
+        */
+
+        if(counts.states.size() != size_t(nstates) or counts.transitions.size() != size_t(nstates) * nclasses) {
+            throw std::invalid_argument("VisitCounters::add: counts of a different table");
+        }
+        auto block = recorder().block;
+        for(size_t i = 0; i < counts.states.size(); i++) {
+            block->states[i] += counts.states[i];
+        }
+        for(size_t i = 0; i < counts.transitions.size(); i++) {
+            block->transitions[i] += counts.transitions[i];
+        }
+    }
+};
+
+template<class T>
+inline void write_pod(std::ostream& out, T value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<class T>
+inline T read_pod(std::istream& in) {
+    T value;
+    if(!in.read(reinterpret_cast<char*>(&value), sizeof(value))) throw std::runtime_error("checkpoint truncated");
+    return value;
+}
+
+static const uint32_t CHECKPOINT_VERSION = 1;
+
+inline void check_checkpoint_header(std::istream& in, uint32_t magic, uint32_t version, uint64_t fingerprint) {
+    /*
+        Validate magic, format version and automaton fingerprint of a
+        checkpoint; throws std::runtime_error on any mismatch.
+    */
+
+    if(read_pod<uint32_t>(in) != magic) throw std::runtime_error("not a checkpoint of this kind");
+    if(read_pod<uint32_t>(in) != version) throw std::runtime_error("unsupported checkpoint version");
+    if(read_pod<uint64_t>(in) != fingerprint) throw std::runtime_error("checkpoint was taken on a different automaton");
+}
+
+struct Cursor {
+    /*
+        Streaming execution state over a TransitionTable.
+
+        Input can be fed in arbitrary pieces; feeding "ab" then "c" ends in
+        the same state as feeding "abc". With a StrideTable, uninstrumented
+        feeds consume two bytes per lookup and the odd tail one at a time.
+
+        @param const TransitionTable* table: compiled automaton
+        @param const StrideTable* stride: two-byte table of `table`, or nullptr
+        @param int32_t state: current state
+        @param uint64_t offset: number of bytes consumed
+    */
+
+    const TransitionTable* table;
+    const StrideTable* stride;
+    int32_t state;
+    uint64_t offset;
+
+    explicit Cursor(const TransitionTable& t, const StrideTable* s = nullptr) : table{&t}, stride{s}, state{t.q}, offset{0} {}
+
+    template<class Instrument = NoInstrumentation>
+    void feed(const char* data, size_t length, Instrument instrument = Instrument()) {
+        auto next = table->next.data();
+        auto classes = table->classes.data();
+        size_t nclasses = size_t(table->nclasses);
+        auto current = state;
+
+        size_t i = 0;
+        if(stride and std::is_same<Instrument, NoInstrumentation>::value) {
+            auto next2 = stride->next.data();
+            size_t width = nclasses * nclasses;
+            for(; i + 2 <= length; i += 2) {
+                size_t pair = classes[static_cast<unsigned char>(data[i])] * nclasses + classes[static_cast<unsigned char>(data[i + 1])];
+                current = next2[size_t(current) * width + pair];
+            }
+        }
+        for(; i < length; i++) {
+            size_t column = classes[static_cast<unsigned char>(data[i])];
+            instrument.visit(current, column);
+            current = next[size_t(current) * nclasses + column];
+        }
+
+        state = current;
+        offset += length;
+    }
+
+    void feedBits(const BitTable& bits, const uint8_t* data, size_t nbits) {
+        /*
+            Feed `nbits` bit-packed symbols (see BitTable), eight per lookup;
+            offset counts symbols. Only the last piece fed may end inside a
+            byte.
+        */
+
+        auto next = bits.next.data();
+        auto current = state;
+        size_t nbytes = nbits / 8;
+
+        for(size_t i = 0; i < nbytes; i++) current = next[size_t(current) * 256 + data[i]];
+        if(nbits % 8) current = bits.stepBits(*table, current, data[nbytes], int(nbits % 8));
+
+        state = current;
+        offset += nbits;
+    }
+
+    bool accepted() const {
+        return state == table->f;
+    }
+
+    void reset() {
+        state = table->q;
+        offset = 0;
+    }
+
+    static const uint32_t CHECKPOINT_MAGIC = 0x43414644;    /* "DFAC" */
+    static const uint32_t CHECKPOINT_VERSION = 2;           /* 2: counters */
+
+    void save(std::ostream& out, VisitCounters* counters = nullptr) const {
+        /*
+            Write a checkpoint, host byte order:
+                magic | version | table fingerprint | state | offset |
+                ncounters | ncounters x uint64
+
+            With counters, their sums follow (states, then transitions as
+            in VisitProfile); ncounters is 0 without them.
+        */
+
+        write_pod(out, CHECKPOINT_MAGIC);
+        write_pod(out, CHECKPOINT_VERSION);
+        write_pod(out, table->fingerprint);
+        write_pod(out, state);
+        write_pod(out, offset);
+        if(!counters) {
+            write_pod(out, uint64_t(0));
+            return;
+        }
+        auto counts = counters->profile();
+        write_pod(out, uint64_t(counts.states.size() + counts.transitions.size()));
+        out.write(reinterpret_cast<const char*>(counts.states.data()), counts.states.size() * sizeof(uint64_t));
+        out.write(reinterpret_cast<const char*>(counts.transitions.data()), counts.transitions.size() * sizeof(uint64_t));
+    }
+
+    void restore(std::istream& in, VisitCounters* counters = nullptr) {
+        /*
+            Continue from a checkpoint written by save() on the same
+            automaton; feed the input from byte `offset` on. Saved counters
+            are added to `counters` when given and skipped otherwise.
+        */
+
+        check_checkpoint_header(in, CHECKPOINT_MAGIC, CHECKPOINT_VERSION, table->fingerprint);
+        auto saved_state = read_pod<int32_t>(in);
+        auto saved_offset = read_pod<uint64_t>(in);
+        if(saved_state < 0 or saved_state >= table->nstates) throw std::runtime_error("checkpoint state out of range");
+        auto ncounters = read_pod<uint64_t>(in);
+        auto nstates = size_t(table->nstates);
+        auto ntransitions = nstates * size_t(table->nclasses);
+        if(ncounters != 0 and ncounters != nstates + ntransitions) throw std::runtime_error("checkpoint counters do not match the automaton");
+        if(ncounters != 0) {
+            VisitProfile counts;
+            counts.classes = table->classes;
+            counts.nclasses = table->nclasses;
+            counts.states.resize(nstates);
+            counts.transitions.resize(ntransitions);
+            if(!in.read(reinterpret_cast<char*>(counts.states.data()), nstates * sizeof(uint64_t))
+               or !in.read(reinterpret_cast<char*>(counts.transitions.data()), ntransitions * sizeof(uint64_t))) {
+                throw std::runtime_error("checkpoint truncated");
+            }
+            if(counters) counters->add(counts);
+        }
+        state = saved_state;
+        offset = saved_offset;
+    }
+};
+
+struct StateMap {
+    /*
+        Transition function of one piece of input: the state reached from
+        every possible start state.
+
+        Lets a long input be split into pieces that are scanned
+        independently and chained afterwards:
+            end = map_n[...map_2[map_1[q]]...]
+
+        Maps of one table form a monoid under then() (concatenation of the
+        pieces) with identity(), so pieces can also be combined in any
+        grouping: parallel reduction, range queries, incremental updates.
+
+        @param vector<int32_t> map: map[start] = end state
+    */
+
+    std::vector<int32_t> map;
+
+    static StateMap identity(int nstates) {
+        /*
+            Map of the empty input.
+        */
+
+        StateMap result;
+        result.map.resize(nstates);
+        for(auto state = 0; state < nstates; state++) result.map[state] = state;
+        return result;
+    }
+
+    StateMap then(const StateMap& second) const {
+        /*
+            Map of this piece followed by `second`: result[s] = second[map[s]].
+            Uses AVX2 gathers when the CPU has them.
+        */
+
+        if(second.map.size() != map.size()) throw std::invalid_argument("StateMap::then: maps of different automata");
+        StateMap result;
+        result.map.resize(map.size());
+        compose(map.data(), second.map.data(), result.map.data(), map.size());
+        return result;
+    }
+
+    static void compose(const int32_t* first, const int32_t* second, int32_t* out, size_t n) {
+        /*
+            out[s] = second[first[s]] for s < n; out may alias first.
+        */
+
+#if defined(__x86_64__) or defined(__i386__)
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if(avx2) {
+            compose_avx2(first, second, out, n);
+            return;
+        }
+#endif
+        for(size_t s = 0; s < n; s++) out[s] = second[first[s]];
+    }
+
+#if defined(__x86_64__) or defined(__i386__)
+    __attribute__((target("avx2")))
+    static void compose_avx2(const int32_t* first, const int32_t* second, int32_t* out, size_t n) {
+        size_t s = 0;
+        for(; s + 8 <= n; s += 8) {
+            auto index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + s));
+            auto gathered = _mm256_i32gather_epi32(reinterpret_cast<const int*>(second), index, 4);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + s), gathered);
+        }
+        for(; s < n; s++) out[s] = second[first[s]];
+    }
+#endif
+
+    static StateMap of(const TransitionTable& table, const char* data, size_t length) {
+        /*
+            Simulate the piece from all start states at once.
+
+            Start states that reach the same state are merged, so the work
+            per byte shrinks to the number of distinct live states; for most
+            automata this collapses to a handful within a few bytes.
+        */
+
+        std::vector<int32_t> active(table.nstates);
+        std::vector<int32_t> slot(table.nstates);
+        for(auto state = 0; state < table.nstates; state++) {
+            active[state] = state;
+            slot[state] = state;
+        }
+
+        std::vector<int32_t> seen(table.nstates, -1);
+        auto next = table.next.data();
+        auto classes = table.classes.data();
+        size_t nclasses = size_t(table.nclasses);
+
+        size_t i = 0, merge_at = 16;
+        while(i < length) {
+            auto stop = active.size() > 1 ? std::min(length, merge_at) : length;
+            for(; i < stop; i++) {
+                size_t column = classes[static_cast<unsigned char>(data[i])];
+                for(auto &state: active) state = next[size_t(state) * nclasses + column];
+            }
+
+            /* Merge duplicate states; merges get rarer as the scan goes on */
+            std::vector<int32_t> merged;
+            std::vector<int32_t> remap(active.size());
+            for(size_t k = 0; k < active.size(); k++) {
+                if(seen[active[k]] == -1) {
+                    seen[active[k]] = int32_t(merged.size());
+                    merged.push_back(active[k]);
+                }
+                remap[k] = seen[active[k]];
+            }
+            for(auto state: merged) seen[state] = -1;
+            for(auto &s: slot) s = remap[s];
+            active.swap(merged);
+            merge_at *= 2;
+        }
+
+        StateMap result;
+        result.map.resize(table.nstates);
+        for(auto state = 0; state < table.nstates; state++) result.map[state] = active[slot[state]];
+        return result;
+    }
+
+    int32_t operator[](int32_t start) const {
+        return map[start];
+    }
+
+    bool operator==(const StateMap& other) const {
+        return map == other.map;
+    }
+
+    bool operator!=(const StateMap& other) const {
+        return map != other.map;
+    }
+};
+
+struct Span {
+    /*
+        Non-owning view of an input: `size` bytes starting at `data`.
+    */
+
+    const char* data;
+    size_t size;
+};
+
+template<class Instrument = NoInstrumentation>
+inline void execute_batch(const TransitionTable& table, const Span* inputs, size_t count, uint8_t* results, Instrument instrument = Instrument()) {
+    /*
+        Evaluate many independent inputs against one table.
+
+        @param TransitionTable table: compiled DFA
+        @param const Span* inputs: inputs to evaluate
+        @param size_t count: number of inputs
+        @param uint8_t* results: results[i] = 1 if inputs[i] is accepted, else 0
+        @param Instrument instrument: instrumentation policy, see VisitCounters
+    */
+
+    auto next = table.next.data();
+    auto classes = table.classes.data();
+    size_t nclasses = size_t(table.nclasses);
+
+    for(size_t i = 0; i < count; i++) {
+        auto data = inputs[i].data;
+        int32_t state = table.q;
+        for(size_t k = 0; k < inputs[i].size; k++) {
+            size_t column = classes[static_cast<unsigned char>(data[k])];
+            instrument.visit(state, column);
+            state = next[size_t(state) * nclasses + column];
+        }
+        results[i] = state == table.f;
+    }
+}
+
+inline void sort_spans(const Span* inputs, size_t* order, size_t count, size_t depth = 0) {
+    /*
+        Multikey quicksort (Bentley & Sedgewick) of order[0, count) by the
+        bytes of inputs[order[i]], all of which agree on their first `depth`
+        bytes. Each byte is looked at O(log count) times instead of once per
+        comparison, so long shared prefixes do not make sorting expensive.
+    */
+
+    auto key = [inputs, &depth](size_t i) {
+        return depth < inputs[i].size ? int(static_cast<unsigned char>(inputs[i].data[depth])) : -1;
+    };
+
+    while(count > 1) {
+        if(count < 16) {
+            for(size_t i = 1; i < count; i++) {
+                for(auto j = i; j > 0; j--) {
+                    auto &x = inputs[order[j - 1]], &y = inputs[order[j]];
+                    auto common = std::min(x.size, y.size) - depth;
+                    int c = common ? memcmp(x.data + depth, y.data + depth, common) : 0;
+                    if(c < 0 or (c == 0 and x.size <= y.size)) break;
+                    std::swap(order[j - 1], order[j]);
+                }
+            }
+            return;
+        }
+
+        int a = key(order[0]), b = key(order[count / 2]), c = key(order[count - 1]);
+        auto pivot = std::max(std::min(a, b), std::min(std::max(a, b), c));
+
+        /* Partition into [0, lt) < pivot, [lt, gt) == pivot, [gt, count) > pivot */
+        size_t lt = 0, i = 0, gt = count;
+        while(i < gt) {
+            auto k = key(order[i]);
+            if(k < pivot) std::swap(order[lt++], order[i++]);
+            else if(k > pivot) std::swap(order[i], order[--gt]);
+            else i++;
+        }
+
+        sort_spans(inputs, order, lt, depth);
+        sort_spans(inputs, order + gt, count - gt, depth);
+        if(pivot == -1) return;
+        order += lt;
+        count = gt - lt;
+        depth++;
+    }
+}
+
+inline void execute_batch_shared(const TransitionTable& table, const Span* inputs, size_t count, uint8_t* results) {
+    /*
+        execute_batch for inputs that share prefixes (URLs, paths, repeats).
+
+        Inputs are visited in sorted order, which walks the trie of the batch
+        depth first: the state after every byte of the previous input is kept,
+        so each input resumes from the end of its longest common prefix with
+        its predecessor and the DFA runs once per trie edge instead of once
+        per byte. Duplicates cost only the comparison. This pays off when
+        steps are expensive (tables larger than the caches) and prefixes are
+        long; for small tables or unrelated inputs execute_batch is faster.
+
+        @param TransitionTable table: compiled DFA
+        @param const Span* inputs: inputs to evaluate
+        @param size_t count: number of inputs
+        @param uint8_t* results: results[i] = 1 if inputs[i] is accepted, else 0
+    */
+
+    std::vector<size_t> order(count);
+    for(size_t i = 0; i < count; i++) order[i] = i;
+    sort_spans(inputs, order.data(), count);
+
+    auto next = table.next.data();
+    auto classes = table.classes.data();
+    size_t nclasses = size_t(table.nclasses);
+
+    /* path[d]: state after the first d bytes of the previous input */
+    std::vector<int32_t> path {table.q};
+    const Span* previous = nullptr;
+
+    for(auto i: order) {
+        auto &input = inputs[i];
+        size_t common = 0;
+        if(previous) {
+            auto limit = std::min(previous->size, input.size);
+            uint64_t x, y;
+            for(; common + 8 <= limit; common += 8) {
+                memcpy(&x, input.data + common, 8);
+                memcpy(&y, previous->data + common, 8);
+                if(x != y) break;
+            }
+            while(common < limit and input.data[common] == previous->data[common]) common++;
+        }
+
+        path.resize(common + 1);
+        auto state = path[common];
+        for(auto k = common; k < input.size; k++) {
+            state = next[size_t(state) * nclasses + classes[static_cast<unsigned char>(input.data[k])]];
+            path.push_back(state);
+        }
+        results[i] = state == table.f;
+        previous = &input;
+    }
+}
+
+class CompiledDFA;
+
+class DFA {
+    /*
+        Executes a DFA over input symbols.
+
+        Elements of a DFA
+        Q: Finite Set of states
+            Represented via StateDiagram
+        E: Input symbols
+            Represented as a string (std::string)
+        q: initial state
+            represented as an integer
+        f: final state
+            represented as an integer
+
+        DFA is the mutable, move-only builder; freeze() turns it into an
+        immutable CompiledDFA that threads share by reference count.
+
+        @param StateDiagram state_diagram: state diagram; q
+        @param int q: initial state
+        @param int f: final state
+    */
+    StateDiagram state_diagram;
+    int q = 0;
+    int f = -1;
+
+public:
+    DFA() {};
+    DFA(StateDiagram graph, int init_state, int final_state) : state_diagram {std::move(graph)}, q{init_state}, f{final_state} {}
+
+    DFA(const DFA&) = delete;
+    DFA& operator=(const DFA&) = delete;
+    DFA(DFA&&) = default;
+    DFA& operator=(DFA&&) = default;
+
+    bool execute(std::string input) {
+        /*
+        Execute the DFA over the input string.
+
+        TODO: Templatize for any type of vector of input symbols
+
+        Algorithm
+            1) set current state to q i.e initial state of DFA.
+            2) Iterate over the string.
+                a) get the adjacency list for the current state.
+                b) Binary search the (weight sorted) adjancency list for the current symbols ASCII value
+                    i) of the edges with that weight, set the current state to the first
+                        one leading to another state.
+                    ii) if the symbol has no edge, take the first ANY_SYMBOL edge
+                        leading to another state.
+            3) If the current state is same as the final state, set the final_state_reached flag true
+            4) return final_state_reached
+
+        @param std::string input: Input string to execute DFA on.
+        @return bool final_state_reached: True if the final state was reached, else False.
+        */
+
+        bool final_state_reached = false;
+        int current_state = q; 
+
+        for(char symbol: input) {
+            auto symbol_val = int(symbol);
+            auto curr_adj_list = state_diagram.getState(current_state);
+            auto state = std::lower_bound(curr_adj_list.begin(), curr_adj_list.end(), symbol_val,
+                [](const std::pair<int, int>& edge, int weight) { return edge.first < weight; });
+
+            auto next_state = current_state;
+            bool mentioned = false;
+            for(; state != curr_adj_list.end() and state->first == symbol_val; state++) {
+                mentioned = true;
+                if(state->second != current_state) {
+                    next_state = state->second;
+                    break;
+                }
+            }
+            for(auto any = curr_adj_list.end(); !mentioned and any != curr_adj_list.begin() and (any - 1)->first == ANY_SYMBOL; any--) {
+                if((any - 1)->second != current_state) next_state = (any - 1)->second;
+            }
+            current_state = next_state;
+        }
+
+
+        if(current_state == f) final_state_reached = true;
+
+        return final_state_reached;
+    }
+
+    void setInitialState(int init_state) {
+        q = init_state;
+    }
+    
+    int getInitState() {
+        return q;
+    }
+    
+    void setFinalState(int final_state) {
+        f = final_state;
+    }
+
+    int getFinalstate() {
+        return f;
+    }
+
+    void setStateDiagram(StateDiagram diag) {
+        state_diagram = std::move(diag);
+    }
+
+    const StateDiagram& getStateDiagram() const {
+        return state_diagram;
+    }
+
+    TransitionTable compile() const {
+        return TransitionTable(state_diagram, q, f);
+    }
+
+    std::shared_ptr<const CompiledDFA> freeze() &&;
+    
+};
+
+class CompiledDFA {
+    /*
+        Immutable automaton: the state diagram together with its compiled
+        TransitionTable. Created once by DFA::freeze() and shared through a
+        shared_ptr, so every thread of a pool reads the same tables; each
+        thread runs its own Cursor over them.
+
+        Usage:
+            auto automaton = build_dfa_from_file(filename).freeze();
+            Cursor cursor = automaton->cursor();    // per thread
+
+        @param StateDiagram state_diagram: state diagram
+        @param TransitionTable table: compiled from state_diagram
+        @param unique_ptr<StrideTable> stride: two-byte table, only when it
+            fits in cache (StrideTable::fits)
+        @param unique_ptr<Prefilter> prefilter: required literal or bytes of
+            accepted inputs, extracted by the first getPrefilter(), execute()
+            or executeBatch() call, since extraction can cost far more than
+            the table on large automata
+    */
+
+    StateDiagram state_diagram;
+    TransitionTable table;
+    std::unique_ptr<const StrideTable> stride;
+    mutable std::unique_ptr<const Prefilter> prefilter;
+    mutable std::atomic<const Prefilter*> prefilter_ready {nullptr};
+    mutable std::mutex prefilter_lock;
+
+public:
+    CompiledDFA(StateDiagram graph, int init_state, int final_state)
+        : state_diagram {std::move(graph)}, table {state_diagram, init_state, final_state} {
+        if(StrideTable::fits(table)) stride.reset(new StrideTable(table));
+    }
+
+    CompiledDFA(const CompiledDFA&) = delete;
+    CompiledDFA& operator=(const CompiledDFA&) = delete;
+
+    int getInitState() const {
+        return table.q;
+    }
+
+    int getFinalstate() const {
+        return table.f;
+    }
+
+    const StateDiagram& getStateDiagram() const {
+        return state_diagram;
+    }
+
+    const TransitionTable& getTable() const {
+        return table;
+    }
+
+    const StrideTable* getStride() const {
+        return stride.get();
+    }
+
+    const Prefilter& getPrefilter() const {
+        /*
+            Extract the prefilter on first use; safe from any thread.
+        */
+
+        if(auto ready = prefilter_ready.load(std::memory_order_acquire)) return *ready;
+        std::lock_guard<std::mutex> guard(prefilter_lock);
+        if(!prefilter) {
+            prefilter.reset(new Prefilter(table));
+            prefilter_ready.store(prefilter.get(), std::memory_order_release);
+        }
+        return *prefilter;
+    }
+
+    Cursor cursor() const {
+        return Cursor(table, stride.get());
+    }
+
+    bool execute(const char* data, size_t length) const {
+        /*
+            Same result as DFA::execute, through the prefilter and the
+            transition table.
+        */
+
+        if(!getPrefilter().mayMatch(data, length)) return false;
+        auto run = cursor();
+        run.feed(data, length);
+        return run.accepted();
+    }
+
+    bool execute(const std::string& input) const {
+        return execute(input.data(), input.size());
+    }
+
+    void executeBatch(const Span* inputs, size_t count, uint8_t* results) const {
+        /*
+            execute_batch, skipping inputs the prefilter rejects.
+        */
+
+        auto &prefilter = getPrefilter();
+        if(!prefilter.active()) return execute_batch(table, inputs, count, results);
+        for(size_t i = 0; i < count; i++) {
+            results[i] = 0;
+            if(prefilter.mayMatch(inputs[i].data, inputs[i].size)) execute_batch(table, inputs + i, 1, results + i);
+        }
+    }
+};
+
+typedef std::shared_ptr<const CompiledDFA> CompiledDFAPtr;
+
+inline CompiledDFAPtr DFA::freeze() && {
+    /*
+        Compile the DFA into a shared immutable automaton. The state diagram
+        is moved, not copied; the builder is left empty.
+    */
+
+    return std::make_shared<CompiledDFA>(std::move(state_diagram), q, f);
+}
+
+template<class State = uint32_t>
+class FlowTable {
+    /*
+        Current DFA state of many concurrent streams (flows), keyed by a
+        64 bit flow key such as a hash of a 5-tuple.
+
+        Open addressing with linear probing and backward-shift deletion, so
+        there are no tombstones. A slot holds only the key, the state and
+        the time the flow was last fed: 16 bytes with uint16_t or uint32_t
+        states, and the table doubles before it gets over 3/4 full, so ten
+        million flows take 256 MiB. It does not shrink after erase or
+        evictIdle. New flows start at q. State must hold
+        every state number plus one sentinel.
+
+        Usage:
+            FlowTable<uint16_t> flows(automaton, 1 << 20);
+            bool match = flows.feed(key, packet, length, now);
+            flows.evictIdle(now, 60);
+
+        @param CompiledDFAPtr automaton: automaton all flows run on
+        @param vector<Slot> slots: power of two number of slots
+        @param size_t count: flows in the table
+    */
+
+    struct Slot {
+        uint64_t key;
+        uint32_t last_seen;
+        State state;
+    };
+
+    static const State EMPTY = std::numeric_limits<State>::max();
+    static const size_t BATCH = 16;
+
+    CompiledDFAPtr automaton;
+    const TransitionTable* table;
+    std::vector<Slot> slots;
+    size_t mask;
+    size_t count = 0;
+
+    static uint64_t mix(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    size_t home(uint64_t key) const {
+        return size_t(mix(key)) & mask;
+    }
+
+    size_t probe(uint64_t key) const {
+        /*
+            @return size_t index: slot holding key, or the empty slot ending its probe sequence
+        */
+
+        auto i = home(key);
+        while(slots[i].state != EMPTY and slots[i].key != key) i = (i + 1) & mask;
+        return i;
+    }
+
+    void removeAt(size_t hole) {
+        /* Shift later members of the probe run back into the hole */
+        for(auto i = (hole + 1) & mask; slots[i].state != EMPTY; i = (i + 1) & mask) {
+            auto want = home(slots[i].key);
+            if(((i - want) & mask) >= ((i - hole) & mask)) {
+                slots[hole] = slots[i];
+                hole = i;
+            }
+        }
+        slots[hole].state = EMPTY;
+        count--;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> old(capacity, Slot{0, 0, EMPTY});
+        old.swap(slots);
+        mask = capacity - 1;
+        for(auto &slot: old) {
+            if(slot.state != EMPTY) slots[probe(slot.key)] = slot;
+        }
+    }
+
+    Slot& upsert(uint64_t key, uint32_t now) {
+        if((count + 1) * 4 > slots.size() * 3) rehash(slots.size() * 2);
+        auto &slot = slots[probe(key)];
+        if(slot.state == EMPTY) {
+            slot = Slot{key, now, State(table->q)};
+            count++;
+        }
+        slot.last_seen = now;
+        return slot;
+    }
+
+    State run(State state, const char* data, size_t length) const {
+        auto next = table->next.data();
+        auto classes = table->classes.data();
+        size_t nclasses = size_t(table->nclasses);
+        int32_t current = state;
+        for(size_t i = 0; i < length; i++) {
+            current = next[size_t(current) * nclasses + classes[static_cast<unsigned char>(data[i])]];
+        }
+        return State(current);
+    }
+
+public:
+    explicit FlowTable(CompiledDFAPtr compiled, size_t capacity = 1024) : automaton{std::move(compiled)}, table{&automaton->getTable()} {
+        if(uint64_t(table->nstates) > uint64_t(EMPTY)) throw std::out_of_range("FlowTable: state type too small for automaton");
+        size_t size = 16;
+        while(size * 3 < capacity * 4) size *= 2;
+        slots.assign(size, Slot{0, 0, EMPTY});
+        mask = size - 1;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    size_t memoryBytes() const {
+        return slots.size() * sizeof(Slot);
+    }
+
+    const CompiledDFAPtr& getAutomaton() const {
+        return automaton;
+    }
+
+    bool feed(uint64_t key, const char* data, size_t length, uint32_t now) {
+        /*
+            Feed one packet of a flow, creating the flow if it is new.
+
+            @param uint32_t now: caller's clock, compared by evictIdle
+            @return bool accepted: flow is in the final state afterwards
+        */
+
+        auto &slot = upsert(key, now);
+        slot.state = run(slot.state, data, length);
+        return int32_t(slot.state) == table->f;
+    }
+
+    void feedBatch(const uint64_t* keys, const Span* packets, size_t n, uint32_t now, uint8_t* results) {
+        /*
+            feed() for n packets in order; results[i] = 1 if keys[i] is in
+            the final state after packets[i]. The home slots of the next
+            BATCH packets are prefetched before the current ones run.
+        */
+
+        for(size_t i = 0; i < std::min(n, size_t(BATCH)); i++) __builtin_prefetch(&slots[home(keys[i])]);
+        for(size_t first = 0; first < n; first += BATCH) {
+            auto last = std::min(n, first + BATCH);
+            for(size_t i = last; i < std::min(n, last + BATCH); i++) __builtin_prefetch(&slots[home(keys[i])]);
+            for(size_t i = first; i < last; i++) {
+                results[i] = feed(keys[i], packets[i].data, packets[i].size, now);
+            }
+        }
+    }
+
+    bool find(uint64_t key, State& state) const {
+        auto &slot = slots[probe(key)];
+        if(slot.state == EMPTY) return false;
+        state = slot.state;
+        return true;
+    }
+
+    bool erase(uint64_t key) {
+        auto i = probe(key);
+        if(slots[i].state == EMPTY) return false;
+        removeAt(i);
+        return true;
+    }
+
+    size_t evictIdle(uint32_t now, uint32_t idle) {
+        /*
+            Drop every flow not fed for more than `idle` ticks.
+
+            @return size_t evicted: number of flows dropped
+        */
+
+        size_t evicted = 0;
+        for(size_t i = 0; i < slots.size();) {
+            if(slots[i].state != EMPTY and now - slots[i].last_seen > idle) {
+                removeAt(i);
+                evicted++;
+                continue;
+            }
+            i++;
+        }
+        return evicted;
+    }
+
+    void clear() {
+        std::fill(slots.begin(), slots.end(), Slot{0, 0, EMPTY});
+        count = 0;
+    }
+
+    static const uint32_t CHECKPOINT_MAGIC = 0x46414644;    /* "DFAF" */
+
+    void save(std::ostream& out) const {
+        /*
+            Checkpoint every flow, host byte order:
+                magic | version | table fingerprint | count | count x (key | last_seen | state)
+            States are written as uint32_t, so a table can be restored into
+            a FlowTable with another State type.
+        */
+
+        write_pod(out, CHECKPOINT_MAGIC);
+        write_pod(out, CHECKPOINT_VERSION);
+        write_pod(out, table->fingerprint);
+        write_pod(out, uint64_t(count));
+        for(auto &slot: slots) {
+            if(slot.state == EMPTY) continue;
+            write_pod(out, slot.key);
+            write_pod(out, slot.last_seen);
+            write_pod(out, uint32_t(slot.state));
+        }
+    }
+
+    void restore(std::istream& in) {
+        /*
+            Replace all flows by those of a checkpoint written by save() on
+            the same automaton.
+        */
+
+        check_checkpoint_header(in, CHECKPOINT_MAGIC, CHECKPOINT_VERSION, table->fingerprint);
+        auto n = read_pod<uint64_t>(in);
+
+        clear();
+        if(n > (uint64_t(1) << 32)) throw std::runtime_error("checkpoint flow count out of range");
+        while(slots.size() * 3 < n * 4) rehash(slots.size() * 2);
+        for(uint64_t i = 0; i < n; i++) {
+            auto key = read_pod<uint64_t>(in);
+            auto last_seen = read_pod<uint32_t>(in);
+            auto state = read_pod<uint32_t>(in);
+            if(state >= uint32_t(table->nstates)) throw std::runtime_error("checkpoint state out of range");
+            auto &slot = upsert(key, last_seen);
+            slot.state = State(state);
+        }
+    }
+};
+
+struct Token {
+    /*
+        One token of Tokenizer::tokenize: `length` bytes at `offset`, of
+        type `type` (the accept id of the state the match ended in), or
+        UNMATCHED for a run of bytes that start no token.
+    */
+
+    static const uint32_t UNMATCHED = 0xffffffff;
+
+    uint32_t type;
+    uint32_t length;
+    uint64_t offset;
+};
+
+class Tokenizer {
+    /*
+        Maximal munch (longest match) tokenizer over a CompiledDFA.
+
+        From the current position the table is run until the input ends or
+        the state can no longer reach any accepting state; the longest
+        accepted prefix becomes a token, and matching restarts from q right
+        after it. Bytes where no non-empty token starts are merged into
+        UNMATCHED tokens. Tokens point into the caller's input; nothing is
+        copied. A token or run longer than MAX_TOKEN_BYTES, the most its
+        32 bit length holds, is written as consecutive tokens of one type.
+
+        @param CompiledDFAPtr automaton: automaton to run
+        @param vector<int32_t> accept: accept[state] = token type, -1 if not accepting
+        @param vector<uint8_t> live: live[state] = an accepting state is reachable
+    */
+
+    CompiledDFAPtr automaton;
+    std::vector<int32_t> accept;
+    std::vector<uint8_t> live;
+
+public:
+    static const size_t MAX_TOKEN_BYTES = 0xffffffffu;
+
+    explicit Tokenizer(CompiledDFAPtr compiled, std::vector<int32_t> accept_ids = std::vector<int32_t>())
+        : automaton{std::move(compiled)}, accept{std::move(accept_ids)} {
+        /*
+            @param vector<int32_t> accept_ids: token type per state; when
+                empty, the final state f is the only accepting state, type 0
+        */
+
+        auto &table = automaton->getTable();
+        if(accept.empty() and table.f >= 0 and table.f < table.nstates) {
+            accept.assign(table.nstates, -1);
+            accept[table.f] = 0;
+        }
+        accept.resize(table.nstates, -1);
+
+        /* Live states, by BFS from the accepting states on reversed edges */
+        size_t nclasses = size_t(table.nclasses);
+        std::vector<int32_t> offsets(table.nstates + 1, 0);
+        for(auto target: table.next) offsets[target + 1]++;
+        for(size_t i = 1; i < offsets.size(); i++) offsets[i] += offsets[i-1];
+        std::vector<int32_t> sources(table.next.size());
+        std::vector<int32_t> cursor(offsets.begin(), offsets.end() - 1);
+        for(size_t i = 0; i < table.next.size(); i++) sources[cursor[table.next[i]]++] = int32_t(i / nclasses);
+
+        live.assign(table.nstates, 0);
+        std::vector<int32_t> queue;
+        for(auto state = 0; state < table.nstates; state++) {
+            if(accept[state] < 0) continue;
+            live[state] = 1;
+            queue.push_back(state);
+        }
+        for(size_t head = 0; head < queue.size(); head++) {
+            auto state = queue[head];
+            for(auto k = offsets[state]; k < offsets[state + 1]; k++) {
+                if(live[sources[k]]) continue;
+                live[sources[k]] = 1;
+                queue.push_back(sources[k]);
+            }
+        }
+    }
+
+    const CompiledDFAPtr& getAutomaton() const {
+        return automaton;
+    }
+
+    size_t tokenize(const char* data, size_t length, Token* tokens, size_t capacity, size_t& consumed, uint64_t base = 0) const {
+        /*
+            Split data into tokens.
+
+            Stops early when `capacity` tokens are written; `consumed` is
+            then the number of bytes covered, and the call can be repeated
+            on the rest. The pieces of an over-long token are written by one
+            call unless they alone exceed `capacity`. data should end on a token boundary (a whole
+            record): a token cut by the end of data is matched as far as it
+            goes.
+
+            @param Token* tokens: preallocated output buffer
+            @param size_t capacity: size of tokens
+            @param size_t& consumed: bytes of data covered by the tokens written
+            @param uint64_t base: added to every token offset
+            @return size_t count: tokens written
+        */
+
+        auto &table = automaton->getTable();
+        auto next = table.next.data();
+        auto classes = table.classes.data();
+        size_t nclasses = size_t(table.nclasses);
+        auto accepts = accept.data();
+        auto lives = live.data();
+
+        const size_t NONE = size_t(-1);
+        size_t count = 0, pos = 0, run = NONE;
+        auto emit = [&](uint32_t type, size_t start, size_t end) {
+            if(count == capacity) return false;
+            tokens[count++] = Token{type, uint32_t(end - start), base + start};
+            return true;
+        };
+
+        while(pos < length) {
+            int32_t state = table.q;
+            size_t best = 0;
+            int32_t type = -1;
+            for(size_t i = pos; i < length and lives[state]; i++) {
+                state = next[size_t(state) * nclasses + classes[static_cast<unsigned char>(data[i])]];
+                if(accepts[state] >= 0) {
+                    best = i + 1 - pos;
+                    type = accepts[state];
+                }
+            }
+
+            if(best == 0) {
+                if(run == NONE) run = pos;
+                pos++;
+                if(pos - run == MAX_TOKEN_BYTES) {
+                    if(!emit(Token::UNMATCHED, run, pos)) {
+                        pos = run;
+                        run = NONE;
+                        break;
+                    }
+                    run = NONE;
+                }
+                continue;
+            }
+
+            if(run != NONE) {
+                if(!emit(Token::UNMATCHED, run, pos)) {
+                    pos = run;
+                    run = NONE;
+                    break;
+                }
+                run = NONE;
+            }
+            /* Tokens over the 32 bit length go out as consecutive pieces of one type, all in one call if possible */
+            auto pieces = (best + MAX_TOKEN_BYTES - 1) / MAX_TOKEN_BYTES;
+            if(capacity - count < pieces and count > 0) break;
+            auto end = pos + best;
+            while(pos < end and emit(uint32_t(type), pos, pos + std::min(end - pos, size_t(MAX_TOKEN_BYTES)))) {
+                pos += std::min(end - pos, size_t(MAX_TOKEN_BYTES));
+            }
+            if(pos < end) break;
+        }
+        if(run != NONE and !emit(Token::UNMATCHED, run, pos)) pos = run;
+
+        consumed = pos;
+        return count;
+    }
+};
+
+class StateMapTree {
+    /*
+        Editable text with its DFA result kept up to date.
+
+        The text is held in chunks of about `chunk_bytes`, the nodes of an
+        implicit treap in text order. Every node keeps the StateMap of its
+        chunk and the composition of its whole subtree. An edit splits off
+        the chunks it touches, rescans only them (re-chunked and merged
+        with a small right neighbour), and merges them back: O(k + chunk +
+        nstates log n) expected, whether or not the number of chunks
+        changes. Memory is two StateMaps per chunk, so this suits automata
+        with up to a few thousand states.
+
+        Usage:
+            StateMapTree tree(automaton, document);
+            tree.replace(pos, 3, "new");
+            bool ok = tree.accepted();
+
+        @param CompiledDFAPtr automaton: automaton the maps belong to
+        @param size_t chunk_bytes: target chunk size; chunks stay within [1, 2 * chunk_bytes]
+        @param deque<Node> nodes: treap nodes, unused ones listed in free_nodes
+        @param int32_t root: root node, -1 for no chunks
+    */
+
+    struct Node {
+        std::string chunk;
+        StateMap leaf;
+        StateMap total;
+        size_t length;
+        size_t count;
+        uint32_t priority;
+        int32_t left;
+        int32_t right;
+    };
+
+    CompiledDFAPtr automaton;
+    const TransitionTable* table;
+    size_t chunk_bytes;
+    std::deque<Node> nodes;
+    std::vector<int32_t> free_nodes;
+    int32_t root = -1;
+    std::mt19937 random;
+
+    size_t length(int32_t t) const {
+        return t == -1 ? 0 : nodes[t].length;
+    }
+
+    size_t count(int32_t t) const {
+        return t == -1 ? 0 : nodes[t].count;
+    }
+
+    void pull(int32_t t) {
+        auto &node = nodes[t];
+        node.length = length(node.left) + node.chunk.size() + length(node.right);
+        node.count = count(node.left) + 1 + count(node.right);
+        auto n = size_t(table->nstates);
+        node.total.map.resize(n);
+        if(node.left == -1) std::copy(node.leaf.map.begin(), node.leaf.map.end(), node.total.map.begin());
+        else StateMap::compose(nodes[node.left].total.map.data(), node.leaf.map.data(), node.total.map.data(), n);
+        if(node.right != -1) StateMap::compose(node.total.map.data(), nodes[node.right].total.map.data(), node.total.map.data(), n);
+    }
+
+    int32_t merge(int32_t a, int32_t b) {
+        if(a == -1) return b;
+        if(b == -1) return a;
+        if(nodes[a].priority > nodes[b].priority) {
+            nodes[a].right = merge(nodes[a].right, b);
+            pull(a);
+            return a;
+        }
+        nodes[b].left = merge(a, nodes[b].left);
+        pull(b);
+        return b;
+    }
+
+    void split(int32_t t, size_t k, int32_t& a, int32_t& b) {
+        /* First k chunks of t into a, the rest into b */
+        if(t == -1) {
+            a = b = -1;
+            return;
+        }
+        if(count(nodes[t].left) < k) {
+            split(nodes[t].right, k - count(nodes[t].left) - 1, nodes[t].right, b);
+            a = t;
+        }
+        else {
+            split(nodes[t].left, k, a, nodes[t].left);
+            b = t;
+        }
+        pull(t);
+    }
+
+    int32_t build(std::vector<std::string>& chunks) {
+        /*
+            Treap of new nodes for chunks, in order: a Cartesian tree over
+            random priorities, built with a stack in linear time.
+        */
+
+        std::vector<int32_t> stack;
+        for(auto &chunk: chunks) {
+            int32_t t;
+            if(free_nodes.empty()) {
+                t = int32_t(nodes.size());
+                nodes.emplace_back();
+            }
+            else {
+                t = free_nodes.back();
+                free_nodes.pop_back();
+            }
+            auto &node = nodes[t];
+            node.chunk.swap(chunk);
+            node.leaf = StateMap::of(*table, node.chunk.data(), node.chunk.size());
+            node.priority = random();
+            node.left = node.right = -1;
+
+            int32_t last = -1;
+            while(!stack.empty() and nodes[stack.back()].priority < node.priority) {
+                last = stack.back();
+                stack.pop_back();
+                pull(last);
+            }
+            node.left = last;
+            if(!stack.empty()) nodes[stack.back()].right = t;
+            stack.push_back(t);
+        }
+        while(stack.size() > 1) {
+            pull(stack.back());
+            stack.pop_back();
+        }
+        if(stack.empty()) return -1;
+        pull(stack[0]);
+        return stack[0];
+    }
+
+    void release(int32_t t, std::string& text) {
+        /* Append the text of t to text and free its nodes */
+        if(t == -1) return;
+        release(nodes[t].left, text);
+        text += nodes[t].chunk;
+        std::string().swap(nodes[t].chunk);
+        free_nodes.push_back(t);
+        release(nodes[t].right, text);
+    }
+
+    void rechunk(const std::string& text, std::vector<std::string>& out) const {
+        /* Split into pieces of equal size within [chunk_bytes / 2, 2 * chunk_bytes] */
+        if(text.empty()) return;
+        auto pieces = text.size() <= 2 * chunk_bytes ? 1 : (text.size() + chunk_bytes - 1) / chunk_bytes;
+        for(size_t i = 0; i < pieces; i++) {
+            auto from = text.size() * i / pieces, to = text.size() * (i + 1) / pieces;
+            out.push_back(text.substr(from, to - from));
+        }
+    }
+
+    size_t locate(size_t pos, size_t& start) const {
+        /*
+            @return size_t rank: chunk holding byte `pos` (the last chunk for
+                pos == size()); start is the offset of its first byte
+        */
+
+        size_t rank = 0;
+        start = 0;
+        for(auto t = root; t != -1;) {
+            auto &node = nodes[t];
+            auto left = length(node.left);
+            if(pos < start + left) {
+                t = node.left;
+                continue;
+            }
+            if(pos < start + left + node.chunk.size() or node.right == -1) {
+                start += left;
+                return rank + count(node.left);
+            }
+            start += left + node.chunk.size();
+            rank += count(node.left) + 1;
+            t = node.right;
+        }
+        return 0;
+    }
+
+    int32_t runNodes(int32_t t, size_t node_begin, size_t begin, size_t end, int32_t state) const {
+        /* Apply the maps of the subtrees covering [begin, end) left to right, rescanning partial chunks */
+        if(t == -1) return state;
+        auto &node = nodes[t];
+        auto node_end = node_begin + node.length;
+        if(end <= node_begin or node_end <= begin) return state;
+        if(begin <= node_begin and node_end <= end) return node.total[state];
+
+        state = runNodes(node.left, node_begin, begin, end, state);
+        auto chunk_begin = node_begin + length(node.left);
+        auto chunk_end = chunk_begin + node.chunk.size();
+        if(begin <= chunk_begin and chunk_end <= end) state = node.leaf[state];
+        else {
+            auto from = std::max(begin, chunk_begin), to = std::min(end, chunk_end);
+            for(auto i = from; i < to; i++) state = table->step(state, static_cast<unsigned char>(node.chunk[i - chunk_begin]));
+        }
+        return runNodes(node.right, chunk_end, begin, end, state);
+    }
+
+public:
+    StateMapTree(CompiledDFAPtr compiled, const std::string& text, size_t chunk = 4096)
+        : automaton{std::move(compiled)}, table{&automaton->getTable()}, chunk_bytes{std::max<size_t>(1, chunk)} {
+        std::vector<std::string> chunks;
+        rechunk(text, chunks);
+        if(chunks.empty()) chunks.emplace_back();
+        root = build(chunks);
+    }
+
+    size_t size() const {
+        return length(root);
+    }
+
+    std::string text() const {
+        std::string out;
+        out.reserve(size());
+        std::vector<int32_t> stack;
+        for(auto t = root; t != -1 or !stack.empty();) {
+            if(t != -1) {
+                stack.push_back(t);
+                t = nodes[t].left;
+                continue;
+            }
+            t = stack.back();
+            stack.pop_back();
+            out += nodes[t].chunk;
+            t = nodes[t].right;
+        }
+        return out;
+    }
+
+    void replace(size_t pos, size_t count, const std::string& text) {
+        /*
+            Replace `count` bytes at `pos` by `text` (insert with count 0,
+            erase with empty text).
+        */
+
+        if(pos > size() or count > size() - pos) throw std::out_of_range("StateMapTree::replace: range outside the text");
+        if(count == 0 and text.empty()) return;
+
+        size_t first_start, last_start;
+        auto first = locate(pos, first_start);
+        auto last = count == 0 ? first : locate(pos + count - 1, last_start);
+
+        int32_t before, touched, after, rest;
+        split(root, first, before, rest);
+        split(rest, last - first + 1, touched, after);
+
+        std::string merged;
+        release(touched, merged);
+        merged.replace(pos - first_start, count, text);
+        if(merged.size() < chunk_bytes / 2 and after != -1) {
+            int32_t next;
+            split(after, 1, next, after);
+            release(next, merged);
+        }
+
+        std::vector<std::string> chunks;
+        rechunk(merged, chunks);
+        if(chunks.empty() and before == -1 and after == -1) chunks.emplace_back();
+        root = merge(merge(before, build(chunks)), after);
+    }
+
+    void insert(size_t pos, const std::string& text) {
+        replace(pos, 0, text);
+    }
+
+    void erase(size_t pos, size_t count) {
+        replace(pos, count, std::string());
+    }
+
+    int32_t finalState() const {
+        return nodes[root].total[table->q];
+    }
+
+    bool accepted() const {
+        return finalState() == table->f;
+    }
+
+    int32_t run(size_t begin, size_t end, int32_t state) const {
+        /*
+            @return int32_t state: state reached from `state` over text[begin, end)
+        */
+
+        if(begin > end or end > size()) throw std::out_of_range("StateMapTree::run: range outside the text");
+        return runNodes(root, 0, begin, end, state);
+    }
+
+    bool accepts(size_t begin, size_t end) const {
+        /*
+            Acceptance of the substring text[begin, end) on its own.
+        */
+
+        return run(begin, end, table->q) == table->f;
+    }
+};
+
+inline uint64_t hash_bytes(const char* data, size_t length, uint64_t seed) {
+    /*
+        Fast 64 bit hash, eight bytes per multiply; not cryptographic.
+    */
+
+    const uint64_t k1 = 0x9e3779b97f4a7c15ULL, k2 = 0xbf58476d1ce4e5b9ULL;
+    uint64_t h = seed ^ (uint64_t(length) * k1);
+    uint64_t word;
+    size_t i = 0;
+    for(; i + 8 <= length; i += 8) {
+        memcpy(&word, data + i, 8);
+        h = (h ^ (word * k2)) * k1;
+        h ^= h >> 29;
+    }
+    if(i < length) {
+        word = 0;
+        memcpy(&word, data + i, length - i);
+        h = (h ^ (word * k2)) * k1;
+    }
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+class ResultCache {
+    /*
+        Concurrent cache of accept/reject results in front of
+        CompiledDFA::execute, for traffic that repeats inputs.
+
+        Entries hold the input bytes and the table fingerprint and are only
+        returned for an equal input on the same automaton: after a reload
+        (DFAWatcher) old entries simply stop hitting and age out. Buckets
+        are chosen by hash_bytes seeded with the fingerprint and a random
+        per-process seed, so clients cannot aim many inputs at one bucket.
+        A bucket holds seven entries with CLOCK eviction: hits set a
+        reference bit, inserts clear bits from the bucket hand until they
+        find an unreferenced victim. Each bucket has its own spin lock, held
+        only to compare and copy keys, never while the automaton runs.
+        Inputs longer than MAX_KEY_BYTES bypass the cache, so memory stays
+        below capacity() * MAX_KEY_BYTES plus a bucket per 7 entries.
+
+        Usage:
+            ResultCache cache(1 << 20);
+            bool ok = cache.execute(*automaton, data, length);   // any thread
+            cache.hits(), cache.misses();
+
+        @param Bucket* buckets: power of two number of buckets
+        @param Counters* counters: hit and miss counts, striped by bucket
+        @param uint64_t seed: random per-process hash seed
+    */
+
+    static const unsigned WAYS = 7;
+    static const size_t STRIPES = 16;
+
+    struct Entry {
+        uint64_t fingerprint = 0;
+        std::string key;
+        bool used = false;
+        bool accepted = false;
+    };
+
+    struct alignas(64) Bucket {
+        std::atomic_flag busy = ATOMIC_FLAG_INIT;
+        uint8_t referenced = 0;
+        uint8_t hand = 0;
+        Entry entries[WAYS];
+
+        void lock() {
+            while(busy.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+        }
+
+        void unlock() {
+            busy.clear(std::memory_order_release);
+        }
+    };
+
+    struct alignas(64) Counters {
+        std::atomic<uint64_t> hits {0};
+        std::atomic<uint64_t> misses {0};
+    };
+
+    template<class T>
+    struct Destroy {
+        size_t n;
+
+        void operator()(T* p) const {
+            for(size_t i = 0; i < n; i++) p[i].~T();
+            free(p);
+        }
+    };
+
+    std::unique_ptr<Bucket[], Destroy<Bucket>> buckets;
+    std::unique_ptr<Counters[], Destroy<Counters>> counters;
+    size_t mask;
+    uint64_t seed;
+
+    template<class T>
+    static std::unique_ptr<T[], Destroy<T>> allocate(size_t n) {
+        /* Cache line aligned, which new[] does not promise before C++17 */
+        void* p = nullptr;
+        if(posix_memalign(&p, 64, n * sizeof(T)) != 0) throw std::bad_alloc();
+        for(size_t i = 0; i < n; i++) new(static_cast<T*>(p) + i) T();
+        return std::unique_ptr<T[], Destroy<T>>(static_cast<T*>(p), Destroy<T>{n});
+    }
+
+public:
+    static const size_t MAX_KEY_BYTES = 1024;
+
+    explicit ResultCache(size_t entries = 1 << 16) {
+        size_t nbuckets = 1;
+        while(nbuckets * WAYS < entries) nbuckets *= 2;
+        buckets = allocate<Bucket>(nbuckets);
+        counters = allocate<Counters>(STRIPES);
+        mask = nbuckets - 1;
+        std::random_device device;
+        seed = (uint64_t(device()) << 32) ^ device();
+    }
+
+    size_t capacity() const {
+        return (mask + 1) * WAYS;
+    }
+
+    bool execute(const CompiledDFA& automaton, const char* data, size_t length) {
+        if(length > MAX_KEY_BYTES) return automaton.execute(data, length);
+
+        auto fingerprint = automaton.getTable().fingerprint;
+        auto index = size_t(hash_bytes(data, length, fingerprint ^ seed)) & mask;
+        auto &bucket = buckets[index];
+        auto &counter = counters[index % STRIPES];
+        auto same = [&](const Entry& entry) {
+            return entry.used and entry.fingerprint == fingerprint and entry.key.size() == length and memcmp(entry.key.data(), data, length) == 0;
+        };
+
+        bucket.lock();
+        for(unsigned i = 0; i < WAYS; i++) {
+            if(!same(bucket.entries[i])) continue;
+            bucket.referenced |= uint8_t(1u << i);
+            bool accepted = bucket.entries[i].accepted;
+            bucket.unlock();
+            counter.hits.fetch_add(1, std::memory_order_relaxed);
+            return accepted;
+        }
+        bucket.unlock();
+
+        counter.misses.fetch_add(1, std::memory_order_relaxed);
+        bool accepted = automaton.execute(data, length);
+
+        bucket.lock();
+        for(unsigned i = 0; i < WAYS; i++) {
+            /* Another thread inserted it meanwhile */
+            if(same(bucket.entries[i])) {
+                bucket.unlock();
+                return accepted;
+            }
+        }
+        /* CLOCK: give referenced entries a second chance, at most one sweep */
+        unsigned victim = bucket.hand % WAYS;
+        for(unsigned step = 0; step < WAYS; step++, victim = (victim + 1) % WAYS) {
+            auto bit = uint8_t(1u << victim);
+            if(!(bucket.referenced & bit)) break;
+            bucket.referenced &= uint8_t(~bit);
+        }
+        auto &entry = bucket.entries[victim];
+        entry.fingerprint = fingerprint;
+        entry.key.assign(data, length);
+        entry.used = true;
+        entry.accepted = accepted;
+        bucket.hand = uint8_t((victim + 1) % WAYS);
+        bucket.unlock();
+        return accepted;
+    }
+
+    bool execute(const CompiledDFA& automaton, const std::string& input) {
+        return execute(automaton, input.data(), input.size());
+    }
+
+    uint64_t hits() const {
+        uint64_t total = 0;
+        for(size_t i = 0; i < STRIPES; i++) total += counters[i].hits.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    uint64_t misses() const {
+        uint64_t total = 0;
+        for(size_t i = 0; i < STRIPES; i++) total += counters[i].misses.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    void clear() {
+        for(size_t i = 0; i <= mask; i++) {
+            auto &bucket = buckets[i];
+            bucket.lock();
+            for(auto &entry: bucket.entries) entry = Entry();
+            bucket.referenced = 0;
+            bucket.unlock();
+        }
+        for(size_t i = 0; i < STRIPES; i++) {
+            counters[i].hits.store(0, std::memory_order_relaxed);
+            counters[i].misses.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+static const size_t MAX_REVERSE_STATES = 1 << 20;
+static const size_t MAX_REVERSE_MEMBERS = 1 << 26;
+
+class ReverseDFA {
+    /*
+        Minimal DFA of the reversed language of a compiled automaton: run
+        over the bytes of w from last to first, it accepts exactly when the
+        forward automaton takes q to f on w. Scanning backward from the end
+        of a forward match it finds where the match starts in one pass,
+        instead of restarting the forward automaton from every earlier
+        position.
+
+        Built by subset construction over the reversed transitions (from
+        {f}; a subset accepts when it contains q), then minimized by Moore
+        partition refinement. Subset construction can blow up: more than
+        MAX_REVERSE_STATES subsets, or more than MAX_REVERSE_MEMBERS forward
+        states summed over all subsets (256 MiB), throws std::length_error.
+
+        Usage:
+            ReverseDFA reverse(*automaton);
+            size_t start, end;
+            for(size_t at = 0; find_span(*automaton, reverse, data, length, at, start, end); at = end) ...
+
+        @param array<uint8_t, 256> classes: byte classes, shared with the forward table
+        @param int nclasses: number of byte classes
+        @param int32_t initial: state before any byte is read
+        @param vector<int32_t> next: next[state * nclasses + class]
+        @param vector<uint8_t> accepting: the bytes read so far, reversed, are accepted forward
+        @param vector<uint8_t> live: an accepting state is still reachable
+    */
+
+    std::array<uint8_t, 256> classes;
+    int nclasses;
+    int32_t initial;
+    std::vector<int32_t> next;
+    std::vector<uint8_t> accepting;
+    std::vector<uint8_t> live;
+
+    struct Subsets {
+        /*
+            Every subset stored once, sorted, back to back in `members`;
+            subset i is members[starts[i], starts[i + 1]).
+        */
+
+        std::vector<int32_t> members;
+        std::vector<size_t> starts {0};
+
+        size_t size() const {
+            return starts.size() - 1;
+        }
+
+        const int32_t* begin(size_t i) const {
+            return members.data() + starts[i];
+        }
+
+        const int32_t* end(size_t i) const {
+            return members.data() + starts[i + 1];
+        }
+    };
+
+    struct SubsetHash {
+        const Subsets* subsets;
+
+        size_t operator()(int32_t id) const {
+            auto first = subsets->begin(size_t(id));
+            return size_t(hash_bytes(reinterpret_cast<const char*>(first), size_t(subsets->end(size_t(id)) - first) * sizeof(int32_t), 0));
+        }
+    };
+
+    struct SubsetEqual {
+        const Subsets* subsets;
+
+        bool operator()(int32_t a, int32_t b) const {
+            return std::equal(subsets->begin(size_t(a)), subsets->end(size_t(a)), subsets->begin(size_t(b)), subsets->end(size_t(b)));
+        }
+    };
+
+    void determinize(const TransitionTable& table) {
+        size_t nstates = size_t(table.nstates);
+        size_t width = size_t(nclasses);
+
+        /* Predecessors per (class, state) in CSR form */
+        std::vector<uint32_t> offsets(width * nstates + 1, 0);
+        for(size_t s = 0; s < nstates; s++) {
+            for(size_t c = 0; c < width; c++) offsets[c * nstates + size_t(table.next[s * width + c]) + 1]++;
+        }
+        for(size_t i = 1; i < offsets.size(); i++) offsets[i] += offsets[i - 1];
+        std::vector<int32_t> preds(offsets.back());
+        auto fill = offsets;
+        for(size_t s = 0; s < nstates; s++) {
+            for(size_t c = 0; c < width; c++) preds[fill[c * nstates + size_t(table.next[s * width + c])]++] = int32_t(s);
+        }
+
+        /* Append a candidate as the next subset; drop it again if it is already known */
+        Subsets subsets;
+        std::unordered_set<int32_t, SubsetHash, SubsetEqual> ids(64, SubsetHash{&subsets}, SubsetEqual{&subsets});
+        auto id_of = [&](const std::vector<int32_t>& subset) {
+            if(subsets.members.size() + subset.size() > MAX_REVERSE_MEMBERS) throw std::length_error("ReverseDFA: subsets too large");
+            auto id = int32_t(subsets.size());
+            subsets.members.insert(subsets.members.end(), subset.begin(), subset.end());
+            subsets.starts.push_back(subsets.members.size());
+            auto found = ids.find(id);
+            if(found != ids.end()) {
+                subsets.starts.pop_back();
+                subsets.members.resize(subsets.starts.back());
+                return *found;
+            }
+            if(size_t(id) >= MAX_REVERSE_STATES) throw std::length_error("ReverseDFA: too many states");
+            ids.insert(id);
+            return id;
+        };
+
+        std::vector<int32_t> start {table.f};
+        initial = id_of(start);
+        std::vector<uint32_t> stamp(nstates, 0);
+        uint32_t round = 0;
+        std::vector<int32_t> target;
+        for(size_t i = 0; i < subsets.size(); i++) {
+            for(size_t c = 0; c < width; c++) {
+                round++;
+                target.clear();
+                for(auto member = subsets.begin(i); member != subsets.end(i); member++) {
+                    auto t = *member;
+                    auto key = c * nstates + size_t(t);
+                    for(auto k = offsets[key]; k < offsets[key + 1]; k++) {
+                        auto s = preds[k];
+                        if(stamp[size_t(s)] == round) continue;
+                        stamp[size_t(s)] = round;
+                        target.push_back(s);
+                    }
+                }
+                std::sort(target.begin(), target.end());
+                next.push_back(id_of(target));
+            }
+        }
+
+        accepting.resize(subsets.size());
+        for(size_t i = 0; i < subsets.size(); i++) {
+            accepting[i] = std::binary_search(subsets.begin(i), subsets.end(i), table.q);
+        }
+    }
+
+    void minimize() {
+        size_t width = size_t(nclasses);
+        size_t n = accepting.size();
+        std::vector<int32_t> block(n);
+        for(size_t s = 0; s < n; s++) block[s] = accepting[s];
+        size_t nblocks = 0;
+
+        /* Refine by (block, blocks of all successors) until the count stops growing */
+        std::map<std::vector<int32_t>, int32_t> signatures;
+        std::vector<int32_t> signature(width + 1);
+        std::vector<int32_t> refined(n);
+        while(true) {
+            signatures.clear();
+            for(size_t s = 0; s < n; s++) {
+                signature[0] = block[s];
+                for(size_t c = 0; c < width; c++) signature[c + 1] = block[size_t(next[s * width + c])];
+                refined[s] = signatures.emplace(signature, int32_t(signatures.size())).first->second;
+            }
+            block.swap(refined);
+            if(signatures.size() == nblocks) break;
+            nblocks = signatures.size();
+        }
+
+        std::vector<int32_t> merged(nblocks * width);
+        std::vector<uint8_t> merged_accepting(nblocks);
+        for(size_t s = 0; s < n; s++) {
+            auto b = size_t(block[s]);
+            merged_accepting[b] = accepting[s];
+            for(size_t c = 0; c < width; c++) merged[b * width + c] = block[size_t(next[s * width + c])];
+        }
+        initial = block[size_t(initial)];
+        next.swap(merged);
+        accepting.swap(merged_accepting);
+    }
+
+    void markLive() {
+        size_t width = size_t(nclasses);
+        size_t n = accepting.size();
+        std::vector<std::vector<int32_t>> preds(n);
+        for(size_t s = 0; s < n; s++) {
+            for(size_t c = 0; c < width; c++) preds[size_t(next[s * width + c])].push_back(int32_t(s));
+        }
+        live.assign(n, 0);
+        std::vector<int32_t> stack;
+        for(size_t s = 0; s < n; s++) {
+            if(!accepting[s]) continue;
+            live[s] = 1;
+            stack.push_back(int32_t(s));
+        }
+        while(!stack.empty()) {
+            auto s = stack.back();
+            stack.pop_back();
+            for(auto p: preds[size_t(s)]) {
+                if(live[size_t(p)]) continue;
+                live[size_t(p)] = 1;
+                stack.push_back(p);
+            }
+        }
+    }
+
+public:
+    static const size_t NO_MATCH = size_t(-1);
+
+    explicit ReverseDFA(const TransitionTable& table) : classes{table.classes}, nclasses{table.nclasses} {
+        if(table.f < 0 or table.f >= table.nstates) throw std::invalid_argument("ReverseDFA: final state outside the table");
+        determinize(table);
+        minimize();
+        markLive();
+    }
+
+    explicit ReverseDFA(const CompiledDFA& automaton) : ReverseDFA(automaton.getTable()) {}
+
+    size_t nstates() const {
+        return accepting.size();
+    }
+
+    size_t matchStart(const char* data, size_t end, size_t begin = 0, bool shortest = true) const {
+        /*
+            Scan data[begin, end) backward from end.
+
+            @param bool shortest: stop at the first accepted start instead of
+                scanning on until no start can be accepted any more
+            @return size_t start: the largest (shortest) or smallest (longest)
+                s in [begin, end] such that data[s, end) is accepted forward,
+                NO_MATCH if there is none
+        */
+
+        auto state = initial;
+        size_t found = NO_MATCH;
+        if(accepting[size_t(state)]) {
+            found = end;
+            if(shortest) return found;
+        }
+        for(auto i = end; i > begin and live[size_t(state)]; i--) {
+            state = next[size_t(state) * size_t(nclasses) + classes[static_cast<unsigned char>(data[i - 1])]];
+            if(accepting[size_t(state)]) {
+                found = i - 1;
+                if(shortest) break;
+            }
+        }
+        return found;
+    }
+};
+
+inline bool find_span(const CompiledDFA& automaton, const ReverseDFA& reverse, const char* data, size_t length, size_t from,
+                      size_t& start, size_t& end, bool shortest = true) {
+    /*
+        Locate the first match in data[from, length).
+
+        end is the first offset at which the automaton, started in q at
+        `from`, is in f; start is the matching start found by a backward
+        scan (ReverseDFA::matchStart, bounded by from). For "contains"
+        automata the shortest span is exactly the occurrence of the
+        pattern. Continue from `end` for further matches (past `end` if
+        the span was empty).
+
+        @return bool found: false if the automaton never reaches f
+    */
+
+    auto &table = automaton.getTable();
+    auto next = table.next.data();
+    auto classes = table.classes.data();
+    size_t nclasses = size_t(table.nclasses);
+
+    int32_t state = table.q;
+    for(auto i = from;; i++) {
+        if(state == table.f) {
+            end = i;
+            start = reverse.matchStart(data, end, from, shortest);
+            return true;
+        }
+        if(i == length) return false;
+        state = next[size_t(state) * nclasses + classes[static_cast<unsigned char>(data[i])]];
+    }
+}
+
+/* https://stackoverflow.com/questions/9435385/split-a-string-using-c11 */
+inline std::vector<std::string> split(const std::string &s, char delim) {
+    std::stringstream ss(s);
+    std::string item;
+    std::vector<std::string> elems;
+    while (std::getline(ss, item, delim)) {
+        elems.push_back(item);
+        // elems.push_back(std::move(item)); // if C++11 (based on comment from @mchiasson)
+    }
+    return elems;
+}
+
+/* https://stackoverflow.com/questions/216823/whats-the-best-way-to-trim-stdstring */
+// trim from start (in place)
+static inline void ltrim(std::string &s) {
+    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](int ch) {
+        return !std::isspace(ch);
+    }));
+}
+
+// trim from end (in place)
+static inline void rtrim(std::string &s) {
+    s.erase(std::find_if(s.rbegin(), s.rend(), [](int ch) {
+        return !std::isspace(ch);
+    }).base(), s.end());
+}
+
+// trim from both ends (in place)
+static inline void trim(std::string &s) {
+    ltrim(s);
+    rtrim(s);
+}
+
+// trim from start (copying)
+static inline std::string ltrim_copy(std::string s) {
+    ltrim(s);
+    return s;
+}
+
+// trim from end (copying)
+static inline std::string rtrim_copy(std::string s) {
+    rtrim(s);
+    return s;
+}
+
+// trim from both ends (copying)
+static inline std::string trim_copy(std::string s) {
+    trim(s);
+    return s;
+}
+
+class MappedFile {
+    /*
+        Read-only memory mapping of a whole file.
+
+        @param const char* data: start of the mapping, nullptr for empty files
+        @param size_t length: size of the file in bytes
+    */
+    const char* data_ = nullptr;
+    size_t length_ = 0;
+
+public:
+    explicit MappedFile(const std::string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if(fd < 0) throw std::runtime_error("cannot open " + filename);
+
+        struct stat st;
+        if(fstat(fd, &st) < 0) {
+            close(fd);
+            throw std::runtime_error("cannot stat " + filename);
+        }
+
+        length_ = size_t(st.st_size);
+        if(length_ > 0) {
+            void* addr = mmap(nullptr, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(addr == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("cannot map " + filename);
+            }
+            data_ = static_cast<const char*>(addr);
+        }
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if(data_) munmap(const_cast<char*>(data_), length_);
+    }
+
+    void adviseSequential() {
+        /*
+            Hint the kernel to read ahead aggressively and drop pages behind us.
+        */
+
+        if(data_) madvise(const_cast<char*>(data_), length_, MADV_SEQUENTIAL);
+    }
+
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + length_; }
+    size_t size() const { return length_; }
+};
+
+static inline bool is_blank(char c) {
+    return c == ' ' or c == '\t' or c == '\r';
+}
+
+static inline const char* parse_int(const char* p, const char* end, int& value) {
+    /*
+        Parse a decimal integer, skipping leading blanks.
+
+        @return const char* p: position after the last digit
+    */
+
+    while(p != end and is_blank(*p)) p++;
+
+    bool negative = false;
+    if(p != end and (*p == '-' or *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if(p == end or !std::isdigit(static_cast<unsigned char>(*p))) {
+        throw std::invalid_argument("build_dfa_from_file: expected integer");
+    }
+
+    long long result = 0;
+    while(p != end and std::isdigit(static_cast<unsigned char>(*p))) {
+        result = result * 10 + (*p - '0');
+        if(result > 0x7fffffffLL) throw std::out_of_range("build_dfa_from_file: integer too large");
+        p++;
+    }
+    value = int(negative ? -result : result);
+
+    return p;
+}
+
+static inline const char* parse_code_point(const char* p, const char* end, uint32_t& value) {
+    /*
+        Parse `U+<hex digits>` (blanks already skipped).
+
+        @return const char* p: position after the last digit
+    */
+
+    if(end - p < 3 or (*p != 'U' and *p != 'u') or p[1] != '+' or !std::isxdigit(static_cast<unsigned char>(p[2]))) {
+        throw std::invalid_argument("build_dfa_from_file: expected U+<hex>");
+    }
+    p += 2;
+
+    uint32_t result = 0;
+    while(p != end and std::isxdigit(static_cast<unsigned char>(*p))) {
+        auto c = std::tolower(static_cast<unsigned char>(*p));
+        result = result * 16 + uint32_t(std::isdigit(c) ? c - '0' : c - 'a' + 10);
+        if(result > MAX_CODE_POINT) throw std::out_of_range("build_dfa_from_file: code point too large");
+        p++;
+    }
+    value = result;
+
+    return p;
+}
+
+static void parse_adjacency_chunk(const char* p, const char* end, EdgeBuffer& buffer) {
+    /*
+        Parse adjacency list lines `<vertex_no>: <weight> <vertex_no> | ...`
+        in [p, end) into buffer. Blank lines are skipped. A weight of the
+        form `U+<hex>` or `U+<hex>-U+<hex>` is a code point range edge.
+    */
+
+    while(p != end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if(!eol) eol = end;
+
+        while(p != eol and is_blank(*p)) p++;
+        if(p != eol) {
+            int state;
+            p = parse_int(p, eol, state);
+            while(p != eol and is_blank(*p)) p++;
+            if(p == eol or *p != ':') throw std::invalid_argument("build_dfa_from_file: expected ':'");
+            p++;
+
+            while(true) {
+                int weight, state_no_y;
+                while(p != eol and is_blank(*p)) p++;
+                if(p != eol and (*p == 'U' or *p == 'u')) {
+                    uint32_t lo, hi;
+                    p = parse_code_point(p, eol, lo);
+                    hi = lo;
+                    if(p != eol and *p == '-') p = parse_code_point(p + 1, eol, hi);
+                    if(lo > hi) throw std::invalid_argument("build_dfa_from_file: empty code point range");
+                    p = parse_int(p, eol, state_no_y);
+                    buffer.ranges.push_back(RangeRecord{state, lo, hi, state_no_y});
+                }
+                else {
+                    p = parse_int(p, eol, weight);
+                    p = parse_int(p, eol, state_no_y);
+                    buffer.edges.push_back(EdgeRecord{state, weight, state_no_y});
+                }
+
+                while(p != eol and is_blank(*p)) p++;
+                if(p == eol) break;
+                if(*p != '|') throw std::invalid_argument("build_dfa_from_file: expected '|'");
+                p++;
+            }
+            buffer.nvertices += 1;
+        }
+
+        p = eol == end ? end : eol + 1;
+    }
+}
+
+static const size_t MIN_CHUNK_BYTES = 1 << 22;
+
+inline DFA build_dfa_from_file(std::string filename, size_t nthreads = std::thread::hardware_concurrency()) {
+    /*
+    Build DFA and StateDiagram from file.
+
+    File Structure:
+        (Adjacency List's)
+
+    First Line
+        q -> initial state
+    Second Line
+        f -> final state
+    Next Line(s):
+        <vertex_no>: <weight> <vertex_no> | [<weight> <vertex_no> ... | ...] 
+    where a weight is a byte value, ANY_SYMBOL (256) or a Unicode code point
+    range U+<hex>[-U+<hex>] (see StateDiagramBuilder::insertRange)
+    ``` dfa.gph
+    1               -> initial state
+    2               -> final state
+    1: 97 2 | 37 3    -> Adjacency List for Node 1
+    2: 97 1 | 27 3
+    3: 37 1 | 27 2
+    ```
+
+    Large files are split at line boundaries into chunks of at least
+    MIN_CHUNK_BYTES, one per thread. Each thread parses its chunk
+    into its own EdgeBuffer; StateDiagramBuilder then merges the buffers in
+    file order straight into the StateDiagram's compressed sparse row layout.
+
+    @param std::string filename: filename to read from
+    @param size_t nthreads: most threads to parse with
+    @return DFA dfa: returns a DFA.
+    */
+
+    DFA dfa;
+
+    MappedFile file(filename);
+    const char* p = file.begin();
+    const char* end = file.end();
+
+    /* First two lines: initial and final state */
+    int counter = 0;
+    for(; counter < 2 and p != end; counter++) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if(!eol) eol = end;
+
+        int value;
+        parse_int(p, eol, value);
+        if(value < (counter == 0 ? 0 : -1)) throw std::out_of_range("build_dfa_from_file: negative initial or final state");
+        if(counter == 0) dfa.setInitialState(value);
+        else dfa.setFinalState(value);
+
+        p = eol == end ? end : eol + 1;
+    }
+    if(counter < 2) throw std::invalid_argument("build_dfa_from_file: missing initial or final state");
+
+    /* Split the adjacency lists at line boundaries */
+    size_t body = size_t(end - p);
+    size_t nchunks = std::max<size_t>(1, std::min<size_t>(nthreads, body / MIN_CHUNK_BYTES));
+
+    std::vector<const char*> bounds {p};
+    for(size_t i = 1; i < nchunks; i++) {
+        const char* cut = std::max(bounds.back(), p + body * i / nchunks);
+        const char* eol = static_cast<const char*>(memchr(cut, '\n', end - cut));
+        bounds.push_back(eol ? eol + 1 : end);
+    }
+    bounds.push_back(end);
+
+    std::vector<EdgeBuffer> buffers(nchunks);
+    std::vector<std::exception_ptr> errors(nchunks);
+    auto parse_chunk = [&](size_t i) {
+        try {
+            parse_adjacency_chunk(bounds[i], bounds[i+1], buffers[i]);
+        }
+        catch(...) {
+            errors[i] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(size_t i = 1; i < nchunks; i++) workers.emplace_back(parse_chunk, i);
+    parse_chunk(0);
+    for(auto &worker: workers) worker.join();
+    for(auto &error: errors) {
+        if(error) std::rethrow_exception(error);
+    }
+
+    /* Merge into CSR in file order */
+    auto state_diagram = StateDiagramBuilder(std::move(buffers)).finalize(std::max(dfa.getInitState(), dfa.getFinalstate()));
+
+    dfa.setStateDiagram(std::move(state_diagram));
+
+    return dfa;
+}
+
+class ThreadPool {
+    /*
+        Work-stealing thread pool.
+
+        Every worker owns a deque: it pops its own work from the back and,
+        when empty, steals from the front of the other workers' deques.
+        Tasks submitted from inside a worker go to that worker's deque, so a
+        task that splits itself into pieces keeps them local unless another
+        worker runs dry; tasks from other threads, including workers of
+        other pools, are spread round robin.
+
+        @param vector<Worker> workers: per-thread task deques
+        @param atomic<size_t> pending: tasks submitted but not yet finished
+    */
+
+    struct Worker {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> pending {0};
+    std::atomic<size_t> queued {0};
+    std::atomic<size_t> next_worker {0};
+    std::mutex state_lock;
+    std::condition_variable work_available;
+    std::condition_variable all_done;
+    std::exception_ptr error;
+    bool stopping = false;
+
+    struct CurrentWorker {
+        const ThreadPool* pool;
+        size_t index;
+    };
+
+    static CurrentWorker& current_worker() {
+        /* Pool and deque of the calling thread; pool is null outside any pool */
+        static thread_local CurrentWorker current {nullptr, 0};
+        return current;
+    }
+
+    bool popTask(size_t self, std::function<void()>& task) {
+        {
+            auto &own = *workers[self];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if(!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for(size_t k = 1; k < workers.size(); k++) {
+            auto &victim = *workers[(self + k) % workers.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if(!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        current_worker() = CurrentWorker{this, self};
+        std::function<void()> task;
+
+        while(true) {
+            if(popTask(self, task)) {
+                queued--;
+                try {
+                    task();
+                }
+                catch(...) {
+                    std::lock_guard<std::mutex> guard(state_lock);
+                    if(!error) error = std::current_exception();
+                }
+                task = nullptr;
+
+                if(--pending == 0) {
+                    std::lock_guard<std::mutex> guard(state_lock);
+                    all_done.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> guard(state_lock);
+            work_available.wait(guard, [&] { return stopping or queued > 0; });
+            if(stopping and queued == 0) return;
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t nthreads = std::thread::hardware_concurrency()) {
+        nthreads = std::max<size_t>(1, nthreads);
+        for(size_t i = 0; i < nthreads; i++) workers.emplace_back(new Worker);
+        for(size_t i = 0; i < nthreads; i++) threads.emplace_back(&ThreadPool::run, this, i);
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            stopping = true;
+        }
+        work_available.notify_all();
+        for(auto &thread: threads) thread.join();
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    void submit(std::function<void()> task) {
+        /* A worker of another pool is an outside thread here */
+        auto &self = current_worker();
+        auto index = self.pool == this ? self.index : next_worker++ % workers.size();
+
+        pending++;
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            queued++;
+        }
+        {
+            std::lock_guard<std::mutex> guard(workers[index]->lock);
+            workers[index]->tasks.push_back(std::move(task));
+        }
+        work_available.notify_one();
+    }
+
+    void wait() {
+        /*
+            Block until every submitted task has finished; rethrows the
+            first exception thrown by a task.
+        */
+
+        std::unique_lock<std::mutex> guard(state_lock);
+        all_done.wait(guard, [&] { return pending == 0; });
+        if(error) {
+            auto first = error;
+            error = nullptr;
+            std::rethrow_exception(first);
+        }
+    }
+};
+
+
+inline StateMap parallel_state_map(const TransitionTable& table, const char* data, size_t length, ThreadPool& pool,
+                                   size_t piece_bytes = size_t(1) << 20) {
+    /*
+        StateMap of a whole input, computed piecewise on the pool and
+        combined by a pairwise tree reduction.
+
+        Waits on the pool, so it must not be called from one of its tasks.
+
+        @param size_t piece_bytes: input bytes per task
+        @return StateMap map: map[start] = state after all of data
+    */
+
+    size_t npieces = std::max<size_t>(1, (length + piece_bytes - 1) / piece_bytes);
+    std::vector<StateMap> maps(npieces);
+    for(size_t k = 0; k < npieces; k++) {
+        pool.submit([&, k] {
+            auto begin = k * piece_bytes;
+            auto end = std::min(length, begin + piece_bytes);
+            maps[k] = StateMap::of(table, data + begin, end - begin);
+        });
+    }
+    pool.wait();
+
+    for(size_t step = 1; step < npieces; step *= 2) {
+        for(size_t k = 0; k + step < npieces; k += 2 * step) {
+            pool.submit([&, k, step] {
+                StateMap::compose(maps[k].map.data(), maps[k + step].map.data(), maps[k].map.data(), maps[k].map.size());
+            });
+        }
+        pool.wait();
+    }
+    return std::move(maps[0]);
+}
+
+class DFAWatcher {
+    /*
+        Keeps a CompiledDFA in sync with its .gph file for long-running
+        scanners.
+
+        A background thread polls the file every `interval`; when its inode,
+        size or modification time changes the file is rebuilt and frozen off
+        to the side, then published with an atomic shared_ptr store (RCU
+        style). Scanners take a snapshot with load() per unit of work: work
+        in flight keeps running on the version it started with, and an old
+        version is freed when its last snapshot is dropped. A file that
+        fails to load is reported on stderr and the current version is kept.
+
+        Usage:
+            DFAWatcher watcher(filename);
+            auto automaton = watcher.load();   // per block / file / request
+
+        @param CompiledDFAPtr current: published automaton
+        @param atomic<uint64_t> version: number of successful loads
+    */
+
+    std::string filename;
+    std::chrono::milliseconds interval;
+    CompiledDFAPtr current;
+    std::atomic<uint64_t> version {0};
+    struct stat seen;
+    std::mutex reload_lock;
+    std::mutex state_lock;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread thread;
+
+    static bool same_file(const struct stat& a, const struct stat& b) {
+        return a.st_ino == b.st_ino and a.st_dev == b.st_dev and a.st_size == b.st_size
+            and a.st_mtim.tv_sec == b.st_mtim.tv_sec and a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> guard(state_lock);
+        while(!wake.wait_for(guard, interval, [&] { return stopping; })) {
+            guard.unlock();
+            poll();
+            guard.lock();
+        }
+    }
+
+public:
+    explicit DFAWatcher(std::string path, std::chrono::milliseconds poll_interval = std::chrono::milliseconds(1000))
+        : filename{std::move(path)}, interval{poll_interval} {
+        if(stat(filename.c_str(), &seen) != 0) throw std::runtime_error("cannot stat " + filename);
+        std::atomic_store(&current, build_dfa_from_file(filename).freeze());
+        version = 1;
+        thread = std::thread(&DFAWatcher::run, this);
+    }
+
+    DFAWatcher(const DFAWatcher&) = delete;
+    DFAWatcher& operator=(const DFAWatcher&) = delete;
+
+    ~DFAWatcher() {
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+    CompiledDFAPtr load() const {
+        /*
+            Snapshot of the current automaton; stays valid however many
+            reloads happen while it is held.
+        */
+
+        return std::atomic_load(&current);
+    }
+
+    uint64_t getVersion() const {
+        return version.load();
+    }
+
+    bool poll() {
+        /*
+            Reload now if the file changed since the last load.
+
+            @return bool reloaded: a new version was published
+        */
+
+        std::lock_guard<std::mutex> guard(reload_lock);
+        struct stat st;
+        if(stat(filename.c_str(), &st) != 0 or same_file(st, seen)) return false;
+
+        try {
+            auto automaton = build_dfa_from_file(filename).freeze();
+            /* Extract the prefilter here, not in the first request after the swap */
+            automaton->getPrefilter();
+            seen = st;
+            std::atomic_store(&current, std::move(automaton));
+            version++;
+            return true;
+        }
+        catch(const std::exception& e) {
+            /* Likely caught mid-write; retried on the next change */
+            seen = st;
+            std::cerr<<"Reload of "<<filename<<" failed: "<<e.what()<<std::endl;
+            return false;
+        }
+    }
+};
+
+#endif
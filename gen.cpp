@@ -0,0 +1,96 @@
+/*
+    Random DFA and input corpus generator
+
+    Writes a .gph file of a given shape and, optionally, a newline-delimited
+    input corpus (for `dfa_bin --lines`) with a chosen accept ratio. With
+    --keywords it instead writes the Aho-Corasick "contains any keyword"
+    DFA of a newline-delimited keyword list.
+
+    Usage:
+        ./dfa_gen --output <dfa.gph> [--shape random|chain|substring|aho]
+                  [--states N] [--out-degree D] [--alphabet A] [--seed S]
+                  [--corpus <inputs.txt> --count N --length L --accept-ratio R]
+        ./dfa_gen --output <dfa.gph> --keywords <keywords.txt>
+*/
+#include "dfa.hpp"
+#include "synth.hpp"
+#include "aho_corasick.hpp"
+
+#include <cstdio>
+
+int main(int argc, char** argv) {
+    std::string output, corpus, keywords;
+    Shape shape = Shape::Random;
+    int nstates = 100, out_degree = -1, alphabet = 2;
+    size_t count = 1000, length = 64;
+    double accept_ratio = 0.5;
+    uint64_t seed = 42;
+
+    try {
+        for(auto i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if(i + 1 >= argc) throw std::invalid_argument("missing value for " + arg);
+            std::string value = argv[++i];
+
+            if(arg == "--output") output = value;
+            else if(arg == "--shape") shape = parse_shape(value);
+            else if(arg == "--states") nstates = std::stoi(value);
+            else if(arg == "--out-degree") out_degree = std::stoi(value);
+            else if(arg == "--alphabet") alphabet = std::stoi(value);
+            else if(arg == "--seed") seed = std::stoull(value);
+            else if(arg == "--corpus") corpus = value;
+            else if(arg == "--keywords") keywords = value;
+            else if(arg == "--count") count = std::stoull(value);
+            else if(arg == "--length") length = std::stoull(value);
+            else if(arg == "--accept-ratio") accept_ratio = std::stod(value);
+            else throw std::invalid_argument("unknown option " + arg);
+        }
+        if(output.empty()) throw std::invalid_argument("--output is required");
+        if(out_degree < 0) out_degree = alphabet;
+
+        if(!keywords.empty()) {
+            if(!corpus.empty()) throw std::invalid_argument("--corpus cannot be combined with --keywords");
+            std::ifstream in(keywords);
+            if(!in) throw std::runtime_error("cannot read " + keywords);
+            AhoCorasickBuilder builder;
+            std::string keyword;
+            while(std::getline(in, keyword)) {
+                if(!keyword.empty() and keyword.back() == '\r') keyword.pop_back();
+                if(!keyword.empty()) builder.addKeyword(keyword);
+            }
+
+            auto matcher = builder.build(true);
+            auto &automaton = *matcher.getAutomaton();
+            auto &diagram = automaton.getStateDiagram();
+            write_gph(output, diagram, automaton.getInitState(), automaton.getFinalstate());
+            std::fprintf(stderr, "%s: %zu keywords, %d states, %d edges\n", output.c_str(), matcher.size(), diagram.nvertices, diagram.nedges);
+            return 0;
+        }
+
+        std::mt19937_64 rng(seed);
+        auto automaton = synth_automaton(shape, nstates, out_degree, alphabet, rng);
+        write_gph(output, automaton.diagram, automaton.q, automaton.f);
+        std::fprintf(stderr, "%s: %d states, %d edges\n", output.c_str(), automaton.diagram.nvertices, automaton.diagram.nedges);
+
+        if(!corpus.empty()) {
+            DFA dfa(automaton.diagram, automaton.q, automaton.f);
+            auto table = dfa.compile();
+            auto inputs = synth_inputs(table, alphabet, count, length, accept_ratio, rng);
+
+            std::ofstream out(corpus);
+            size_t accepted = 0;
+            for(auto &input: inputs) {
+                out<<input<<'\n';
+                accepted += dfa.execute(input);
+            }
+            if(!out) throw std::runtime_error("cannot write " + corpus);
+            std::fprintf(stderr, "%s: %zu inputs, %zu accepted\n", corpus.c_str(), inputs.size(), accepted);
+        }
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
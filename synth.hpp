@@ -0,0 +1,370 @@
+/*
+    Synthetic automata and input corpora for benchmarking.
+
+    Used by the benchmark suite (bench.cpp) and the generator tool (gen.cpp).
+*/
+#ifndef SYNTH_HPP
+#define SYNTH_HPP
+
+#include "dfa.hpp"
+
+#include <random>
+#include <limits>
+#include <set>
+
+static const int SYMBOL_BASE = 48;
+static const int MAX_ALPHABET = 128 - SYMBOL_BASE;
+static const int MAX_STATES = 1000000;
+
+enum class Shape {
+    Random,
+    Chain,
+    Substring,
+    AhoCorasick
+};
+
+struct SynthAutomaton {
+    StateDiagram diagram;
+    int q;
+    int f;
+};
+
+inline Shape parse_shape(const std::string& name) {
+    if(name == "random") return Shape::Random;
+    if(name == "chain") return Shape::Chain;
+    if(name == "substring") return Shape::Substring;
+    if(name == "aho") return Shape::AhoCorasick;
+    throw std::invalid_argument("unknown shape " + name);
+}
+
+inline StateDiagram finish_diagram(StateDiagramBuilder& builder, int nstates) {
+    for(auto state = 0; state < nstates; state++) builder.addVertex();
+    return builder.finalize();
+}
+
+inline std::vector<int> random_symbols(int count, int alphabet, std::mt19937_64& rng) {
+    /*
+        `count` distinct symbols out of the alphabet, in random order.
+    */
+
+    std::vector<int> symbols(alphabet);
+    for(auto i = 0; i < alphabet; i++) symbols[i] = SYMBOL_BASE + i;
+    std::shuffle(symbols.begin(), symbols.end(), rng);
+    symbols.resize(std::min(count, alphabet));
+    return symbols;
+}
+
+inline SynthAutomaton keyword_automaton(const std::vector<std::vector<int>>& keywords, int alphabet) {
+    /*
+        "Contains any keyword" DFA: keyword trie with failure links resolved
+        into complete transitions over the alphabet, all keyword ends merged
+        into one absorbing final state. One keyword gives the KMP automaton,
+        e.g. {"11"} over {'0', '1'} is dfa_11.gph.
+
+        @param vector<vector<int>> keywords: keywords as symbol indices 0..alphabet-1
+    */
+
+    const int FINAL = -2;
+    std::vector<int> go(alphabet, -1);
+
+    for(auto &keyword: keywords) {
+        int node = 0;
+        for(size_t i = 0; i < keyword.size(); i++) {
+            auto slot = size_t(node) * alphabet + keyword[i];
+            if(go[slot] == FINAL) break;
+            if(i + 1 == keyword.size()) {
+                go[slot] = FINAL;
+                break;
+            }
+            if(go[slot] == -1) {
+                go[slot] = int(go.size() / alphabet);
+                go.resize(go.size() + alphabet, -1);
+            }
+            node = go[slot];
+        }
+    }
+
+    /* BFS over the trie, resolving failure links into delta */
+    size_t nnodes = go.size() / alphabet;
+    std::vector<int> delta(go.size(), 0);
+    std::vector<int> fail(nnodes, 0);
+    std::vector<int> queue {0};
+    for(size_t head = 0; head < queue.size(); head++) {
+        auto node = queue[head];
+        for(auto c = 0; c < alphabet; c++) {
+            auto slot = size_t(node) * alphabet + c;
+            auto child = go[slot];
+            auto fallback = node == 0 ? 0 : delta[size_t(fail[node]) * alphabet + c];
+            if(child == -1) {
+                delta[slot] = fallback;
+            }
+            else if(child == FINAL or fallback == FINAL) {
+                delta[slot] = FINAL;
+            }
+            else {
+                fail[child] = fallback;
+                delta[slot] = child;
+                queue.push_back(child);
+            }
+        }
+    }
+
+    int nstates = int(nnodes) + 1;
+
+    SynthAutomaton automaton;
+    StateDiagramBuilder builder;
+    automaton.q = 1;
+    automaton.f = nstates;
+    for(size_t node = 0; node < nnodes; node++) {
+        for(auto c = 0; c < alphabet; c++) {
+            auto target = delta[node * alphabet + c];
+            builder.insertEdge(int(node) + 1, SYMBOL_BASE + c, target == FINAL ? nstates : target + 1);
+        }
+    }
+    for(auto c = 0; c < alphabet; c++) builder.insertEdge(nstates, SYMBOL_BASE + c, nstates);
+    automaton.diagram = finish_diagram(builder, nstates);
+
+    return automaton;
+}
+
+inline SynthAutomaton synth_automaton(Shape shape, int nstates, int out_degree, int alphabet, std::mt19937_64& rng) {
+    /*
+        Generate an automaton of a given connectivity shape.
+
+        Symbols are the `alphabet` consecutive bytes starting at SYMBOL_BASE ('0').
+
+        Shapes
+            Random: every state has `out_degree` edges on distinct symbols to
+                uniformly chosen states; f is a random state.
+            Chain: state i moves to i+1 on one symbol and back to a random
+                earlier state on out_degree - 1 others; f = nstates. Other
+                symbols keep the state, so this accepts a subsequence.
+            Substring: KMP automaton for one random word of nstates - 1
+                symbols (like dfa_11.gph); complete over the alphabet.
+            AhoCorasick: complete automaton for random keywords (2-8 symbols,
+                longer on small alphabets), grown until the trie has at most
+                nstates states.
+
+        @param Shape shape: connectivity shape
+        @param int nstates: number of states (upper bound for AhoCorasick)
+        @param int out_degree: edges per state for Random and Chain
+        @param int alphabet: number of input symbols, at most MAX_ALPHABET
+        @return SynthAutomaton automaton: diagram, q and f
+    */
+
+    if(nstates < 2 or nstates > MAX_STATES) throw std::out_of_range("synth_automaton: state count must be in [2, MAX_STATES]");
+    if(alphabet < 1 or alphabet > MAX_ALPHABET) throw std::out_of_range("synth_automaton: alphabet too large");
+    out_degree = std::max(1, std::min(out_degree, alphabet));
+
+    std::uniform_int_distribution<int> pick_symbol(0, alphabet - 1);
+
+    switch(shape) {
+        case Shape::Random: {
+            SynthAutomaton automaton;
+            StateDiagramBuilder builder;
+            std::uniform_int_distribution<int> pick_state(1, nstates);
+            for(auto state = 1; state <= nstates; state++) {
+                for(auto symbol: random_symbols(out_degree, alphabet, rng)) {
+                    builder.insertEdge(state, symbol, pick_state(rng));
+                }
+            }
+            automaton.diagram = finish_diagram(builder, nstates);
+            automaton.q = 1;
+            automaton.f = pick_state(rng);
+            return automaton;
+        }
+
+        case Shape::Chain: {
+            SynthAutomaton automaton;
+            StateDiagramBuilder builder;
+            for(auto state = 1; state < nstates; state++) {
+                auto symbols = random_symbols(out_degree, alphabet, rng);
+                builder.insertEdge(state, symbols[0], state + 1);
+                std::uniform_int_distribution<int> pick_back(1, state);
+                for(size_t k = 1; k < symbols.size(); k++) {
+                    builder.insertEdge(state, symbols[k], pick_back(rng));
+                }
+            }
+            automaton.diagram = finish_diagram(builder, nstates);
+            automaton.q = 1;
+            automaton.f = nstates;
+            return automaton;
+        }
+
+        case Shape::Substring: {
+            std::vector<int> word(nstates - 1);
+            for(auto &c: word) c = pick_symbol(rng);
+            return keyword_automaton({word}, alphabet);
+        }
+
+        case Shape::AhoCorasick: {
+            /* Longer keywords on small alphabets, so the trie can reach nstates */
+            int max_length = 8;
+            for(double capacity = alphabet; capacity < nstates; capacity *= alphabet) max_length++;
+
+            std::vector<std::vector<int>> keywords;
+            std::set<std::vector<int>> prefixes;
+            std::uniform_int_distribution<int> pick_length(std::max(2, max_length - 6), max_length);
+            while(int(prefixes.size()) + 2 < nstates) {
+                std::vector<int> keyword(pick_length(rng));
+                for(auto &c: keyword) c = pick_symbol(rng);
+
+                /* Cut the keyword where its next trie node would exceed nstates */
+                for(size_t i = 1; i < keyword.size(); i++) {
+                    std::vector<int> prefix(keyword.begin(), keyword.begin() + i);
+                    if(!prefixes.count(prefix) and int(prefixes.size()) + 2 >= nstates) {
+                        keyword.resize(i);
+                        break;
+                    }
+                    prefixes.insert(prefix);
+                }
+                keywords.push_back(keyword);
+            }
+            return keyword_automaton(keywords, alphabet);
+        }
+    }
+
+    throw std::invalid_argument("synth_automaton: unknown shape");
+}
+
+inline void write_gph(const std::string& filename, const StateDiagram& diagram, int init_state, int final_state) {
+    /*
+        Write a diagram in the .gph format read by build_dfa_from_file.
+    */
+
+    std::ofstream out(filename);
+    out<<init_state<<"\n"<<final_state<<"\n";
+    for(auto i = 1; i <= diagram.lastState(); i++) {
+        auto adjList = diagram.getState(i);
+        if(adjList.empty()) continue;
+        out<<i<<":";
+        for(size_t k = 0; k < adjList.size(); k++) {
+            out<<(k ? " | " : " ")<<adjList[k].first<<" "<<adjList[k].second;
+        }
+        out<<"\n";
+    }
+    if(!out) throw std::runtime_error("cannot write " + filename);
+}
+
+inline std::vector<std::string> synth_inputs(const TransitionTable& table, int alphabet, size_t count, size_t length, double accept_ratio, std::mt19937_64& rng) {
+    /*
+        Random inputs over the first `alphabet` symbols of which a fraction
+        `accept_ratio` is accepted by the table.
+
+        Accepted inputs are random walks that are steered towards f once the
+        remaining length gets down to the distance to f; rejected inputs keep
+        to states from which f can be avoided forever (or at least avoid f on
+        the last symbol). Inputs whose start is too far from f are made
+        longer than `length`, accepted inputs are cut short where f cannot
+        be left and re-entered, and if f is unreachable from q every input
+        is rejected.
+
+        @return vector<string> inputs: shuffled corpus
+    */
+
+    const int unreachable = std::numeric_limits<int>::max();
+
+    /* Distance to f over the alphabet, by BFS on reversed edges */
+    std::vector<std::vector<int32_t>> reverse(table.nstates);
+    for(auto state = 0; state < table.nstates; state++) {
+        for(auto symbol = 0; symbol < alphabet; symbol++) {
+            reverse[table.step(state, SYMBOL_BASE + symbol)].push_back(state);
+        }
+    }
+    std::vector<int> dist(table.nstates, unreachable);
+    std::vector<int32_t> queue {table.f};
+    dist[table.f] = 0;
+    for(size_t head = 0; head < queue.size(); head++) {
+        for(auto prev: reverse[queue[head]]) {
+            if(dist[prev] != unreachable) continue;
+            dist[prev] = dist[queue[head]] + 1;
+            queue.push_back(prev);
+        }
+    }
+
+    /* States from which some infinite walk never enters f */
+    std::vector<int> escapes(table.nstates, 0);
+    std::vector<uint8_t> avoids(table.nstates, 1);
+    queue.assign(1, table.f);
+    avoids[table.f] = 0;
+    for(auto state = 0; state < table.nstates; state++) {
+        for(auto symbol = 0; symbol < alphabet; symbol++) {
+            escapes[state] += table.step(state, SYMBOL_BASE + symbol) != table.f;
+        }
+        if(avoids[state] and escapes[state] == 0) {
+            avoids[state] = 0;
+            queue.push_back(state);
+        }
+    }
+    for(size_t head = 0; head < queue.size(); head++) {
+        for(auto prev: reverse[queue[head]]) {
+            if(queue[head] == table.f or !avoids[prev]) continue;
+            if(--escapes[prev] == 0) {
+                avoids[prev] = 0;
+                queue.push_back(prev);
+            }
+        }
+    }
+
+    std::uniform_int_distribution<int> pick_symbol(0, alphabet - 1);
+    auto naccept = dist[table.q] == unreachable ? 0 : size_t(count * accept_ratio + 0.5);
+
+    std::vector<std::string> inputs;
+    inputs.reserve(count);
+    for(size_t n = 0; n < count; n++) {
+        bool accept = n < naccept;
+        std::string input;
+        int32_t state = table.q;
+
+        for(size_t i = 0;; i++) {
+            if(i >= length and (!accept or state == table.f)) break;
+            if(i > length + size_t(table.nstates)) throw std::logic_error("synth_inputs: accepting walk does not reach f");
+            size_t remaining = length > i ? length - i : 1;
+            auto symbol = pick_symbol(rng);
+            auto next = table.step(state, SYMBOL_BASE + symbol);
+
+            if(accept and (dist[next] == unreachable or size_t(dist[next]) >= remaining)) {
+                /* Another random step from which f is still reachable in time, else one along a shortest path */
+                int found = -1;
+                for(auto k = 0; k < alphabet and found < 0; k++) {
+                    auto s = (symbol + k) % alphabet;
+                    auto d = dist[table.step(state, SYMBOL_BASE + s)];
+                    if(d != unreachable and size_t(d) < remaining) found = s;
+                }
+                for(auto s = 0; s < alphabet and found < 0 and dist[state] > 0; s++) {
+                    if(dist[table.step(state, SYMBOL_BASE + s)] == dist[state] - 1) found = s;
+                }
+                /* In f with no way back to it in time: end the input here */
+                if(found < 0) break;
+                symbol = found;
+            }
+            else if(!accept and avoids[state] and !avoids[next]) {
+                /* Stay clear of f, starting from a random symbol */
+                for(auto k = 0; k < alphabet; k++) {
+                    auto s = (symbol + k) % alphabet;
+                    if(avoids[table.step(state, SYMBOL_BASE + s)]) {
+                        symbol = s;
+                        break;
+                    }
+                }
+            }
+            else if(!accept and remaining == 1 and next == table.f) {
+                for(auto s = 0; s < alphabet; s++) {
+                    if(table.step(state, SYMBOL_BASE + s) != table.f) {
+                        symbol = s;
+                        break;
+                    }
+                }
+            }
+
+            input.push_back(char(SYMBOL_BASE + symbol));
+            state = table.step(state, SYMBOL_BASE + symbol);
+        }
+        inputs.push_back(std::move(input));
+    }
+
+    std::shuffle(inputs.begin(), inputs.end(), rng);
+    return inputs;
+}
+
+#endif
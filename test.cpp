@@ -0,0 +1,1237 @@
+/*
+    Differential tests
+
+    Checks the optimized engines against straightforward references on
+    synthetic automata: find_span and ReverseDFA against brute force,
+    Prefilter soundness, UTF-8 range expansion against decoding the input,
+    Cursor checkpoints, and the dfa_bin modes against the library. Prints
+    every failure and exits with 1 if there was any.
+
+    Usage:
+        make test
+*/
+#include "dfa.hpp"
+#include "synth.hpp"
+#include "aho_corasick.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <signal.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <tuple>
+
+static int failures = 0;
+
+static void check(bool ok, const char* test, const std::string& detail) {
+    if(ok) return;
+    failures++;
+    std::fprintf(stderr, "FAIL %s: %s\n", test, detail.c_str());
+}
+
+static bool forward_accepts(const TransitionTable& table, const std::string& input, size_t begin, size_t end) {
+    int32_t state = table.q;
+    for(auto i = begin; i < end; i++) state = table.step(state, input[i]);
+    return state == table.f;
+}
+
+static std::string random_input(int alphabet, size_t max_length, std::mt19937_64& rng) {
+    std::string input;
+    auto length = rng() % (max_length + 1);
+    for(size_t i = 0; i < length; i++) input += char(SYMBOL_BASE + rng() % alphabet);
+    return input;
+}
+
+static int run_command(const std::string& command, std::string& output) {
+    /*
+        Run a shell command and collect its stdout.
+
+        @return int status: exit status, -1 if it did not exit normally
+    */
+
+    output.clear();
+    auto pipe = popen(command.c_str(), "r");
+    if(!pipe) return -1;
+    char buffer[4096];
+    size_t got;
+    while((got = fread(buffer, 1, sizeof(buffer), pipe)) > 0) output.append(buffer, got);
+    auto status = pclose(pipe);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void write_file(const std::string& path, const std::string& content) {
+    std::ofstream out(path, std::ios::binary);
+    out<<content;
+}
+
+static void test_find_span() {
+    /*
+        matchStart and find_span on random automata of every shape, against
+        trying every start and end offset.
+    */
+
+    std::mt19937_64 rng(9);
+    for(int round = 0; round < 400; round++) {
+        auto shape = Shape(round % 4);
+        int alphabet = 2 + rng() % 3;
+        auto synth = synth_automaton(shape, 2 + rng() % 16, alphabet, alphabet, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        auto &table = automaton->getTable();
+        ReverseDFA reverse(*automaton);
+
+        for(int k = 0; k < 30; k++) {
+            auto input = random_input(alphabet, 40, rng);
+            size_t end = rng() % (input.size() + 1);
+            size_t begin = rng() % (end + 1);
+
+            auto latest = ReverseDFA::NO_MATCH, earliest = ReverseDFA::NO_MATCH;
+            for(auto s = begin; s <= end; s++) {
+                if(!forward_accepts(table, input, s, end)) continue;
+                if(earliest == ReverseDFA::NO_MATCH) earliest = s;
+                latest = s;
+            }
+            check(reverse.matchStart(input.data(), end, begin, true) == latest, "matchStart shortest", input);
+            check(reverse.matchStart(input.data(), end, begin, false) == earliest, "matchStart longest", input);
+
+            auto expected_end = ReverseDFA::NO_MATCH;
+            for(auto e = begin; e <= input.size(); e++) {
+                if(forward_accepts(table, input, begin, e)) {
+                    expected_end = e;
+                    break;
+                }
+            }
+            size_t start, found_end;
+            bool found = find_span(*automaton, reverse, input.data(), input.size(), begin, start, found_end);
+            check(found == (expected_end != ReverseDFA::NO_MATCH), "find_span found", input);
+            if(found) {
+                check(found_end == expected_end, "find_span end", input);
+                check(start >= begin and forward_accepts(table, input, start, found_end), "find_span start", input);
+            }
+        }
+    }
+
+    AhoCorasickBuilder builder;
+    builder.addKeyword("secret");
+    builder.addKeyword("token");
+    auto matcher = builder.build(true);
+    ReverseDFA reverse(*matcher.getAutomaton());
+    std::string line = "my token is secret and token";
+    std::vector<std::string> spans;
+    size_t start, end;
+    for(size_t at = 0; find_span(*matcher.getAutomaton(), reverse, line.data(), line.size(), at, start, end); at = end) {
+        spans.push_back(line.substr(start, end - start));
+    }
+    check(spans == std::vector<std::string>{"token", "secret", "token"}, "find_span keywords", line);
+}
+
+static void test_prefilter() {
+    /*
+        The prefilter may only skip rejected inputs: executeBatch must agree
+        with execute_batch, and every accepted input must pass mayMatch.
+    */
+
+    std::mt19937_64 rng(11);
+    for(int round = 0; round < 300; round++) {
+        auto shape = Shape(round % 4);
+        int alphabet = 2 + rng() % 3;
+        auto synth = synth_automaton(shape, 2 + rng() % 40, alphabet, alphabet, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        auto &prefilter = automaton->getPrefilter();
+
+        std::vector<std::string> inputs;
+        for(int i = 0; i < 300; i++) inputs.push_back(random_input(alphabet, 120, rng));
+        std::vector<Span> spans;
+        for(auto &input: inputs) spans.push_back(Span{input.data(), input.size()});
+        std::vector<uint8_t> expected(inputs.size()), results(inputs.size());
+        execute_batch(automaton->getTable(), spans.data(), spans.size(), expected.data());
+        automaton->executeBatch(spans.data(), spans.size(), results.data());
+
+        for(size_t i = 0; i < inputs.size(); i++) {
+            check(results[i] == expected[i], "executeBatch", inputs[i]);
+            check(automaton->execute(inputs[i]) == bool(expected[i]), "execute", inputs[i]);
+            if(expected[i]) check(prefilter.mayMatch(inputs[i].data(), inputs[i].size()), "mayMatch", inputs[i]);
+        }
+    }
+
+    AhoCorasickBuilder builder;
+    builder.addKeyword("password");
+    builder.addKeyword("passwd");
+    auto matcher = builder.build(true);
+    check(matcher.getAutomaton()->getPrefilter().active(), "prefilter extracted", "password|passwd");
+
+    /* Threads racing to extract the prefilter of a fresh automaton all see the same one */
+    AhoCorasickBuilder racing;
+    racing.addKeyword("needle");
+    auto automaton = racing.build(true).getAutomaton();
+    std::atomic<int> wrong {0};
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++) {
+        threads.emplace_back([&]() {
+            if(!automaton->execute("hay needle hay") or automaton->execute("hay needl hay")) wrong++;
+            if(&automaton->getPrefilter() != &automaton->getPrefilter()) wrong++;
+        });
+    }
+    for(auto &thread: threads) thread.join();
+    check(wrong == 0 and automaton->getPrefilter().getLiteral() == "needle", "prefilter first use", "needle");
+}
+
+static void test_utf8() {
+    /*
+        Random code point range edges, executed by DFA::execute, the compiled
+        table and a .gph round trip, against following the ranges per
+        decoded code point.
+    */
+
+    std::mt19937 rng(9);
+    const uint32_t edges[] = {0, 0x7f, 0x80, 0x7ff, 0x800, 0xfff, 0x1000, 0xd7ff, 0xe000, 0xffff,
+                              0x10000, 0x3ffff, 0x40000, 0x10ffff, 0x41, 0x3b1, 0x4e00};
+    auto pick = [&]() {
+        uint32_t point;
+        do {
+            point = rng() % 3 ? edges[rng() % 17] + rng() % 5 - 2 : rng() % 0x110000;
+        } while(point > 0x10ffff or (point >= 0xd800 and point <= 0xdfff));
+        return point;
+    };
+    std::string path = "/tmp/dfa_test_" + std::to_string(getpid()) + ".gph";
+
+    for(int round = 0; round < 300; round++) {
+        int nstates = 2 + rng() % 4;
+        StateDiagramBuilder builder;
+        std::vector<std::vector<std::tuple<uint32_t, uint32_t, int>>> ranges(nstates + 1);
+        for(int s = 1; s <= nstates; s++) {
+            int count = rng() % 5;
+            for(int i = 0; i < count; i++) {
+                uint32_t lo = pick(), hi = pick();
+                if(lo > hi) std::swap(lo, hi);
+                int y = 1 + rng() % nstates;
+                ranges[s].emplace_back(lo, hi, y);
+                builder.insertRange(s, lo, hi, y);
+            }
+            builder.addVertex();
+        }
+        auto diagram = builder.finalize(nstates);
+        DFA linear(StateDiagram(diagram), 1, nstates);
+        auto compiled = DFA(StateDiagram(diagram), 1, nstates).freeze();
+        write_gph(path, diagram, 1, nstates);
+        auto reloaded = build_dfa_from_file(path);
+
+        for(int k = 0; k < 50; k++) {
+            std::string input;
+            int state = 1;
+            int length = rng() % 8;
+            for(int i = 0; i < length; i++) {
+                auto point = pick();
+                uint8_t bytes[4];
+                input.append(reinterpret_cast<char*>(bytes), utf8_encode(point, bytes));
+                for(auto &range: ranges[state]) {
+                    if(std::get<0>(range) <= point and point <= std::get<1>(range)) {
+                        state = std::get<2>(range);
+                        break;
+                    }
+                }
+            }
+            bool expected = state == nstates;
+            check(linear.execute(input) == expected, "utf8 DFA::execute", std::to_string(round));
+            check(compiled->execute(input) == expected, "utf8 CompiledDFA::execute", std::to_string(round));
+            check(reloaded.execute(input) == expected, "utf8 .gph round trip", std::to_string(round));
+        }
+    }
+
+    /* Intermediate states must not take the numbers of q or f */
+    {
+        std::ofstream out(path);
+        out<<"1\n3\n1: U+00E9 2\n";
+    }
+    auto automaton = build_dfa_from_file(path);
+    check(!automaton.execute("\xC3"), "utf8 partial sequence", "\\xC3");
+    check(!automaton.execute("\xC3\xA9"), "utf8 edge to 2", "\\xC3\\xA9");
+    std::remove(path.c_str());
+}
+
+static void test_checkpoint() {
+    /*
+        A cursor saved midway and restored, with counters, ends where an
+        uninterrupted one does.
+    */
+
+    std::mt19937_64 rng(5);
+    for(int round = 0; round < 50; round++) {
+        auto synth = synth_automaton(Shape(round % 4), 2 + rng() % 30, 3, 3, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        auto input = random_input(3, 200, rng);
+        size_t split = rng() % (input.size() + 1);
+
+        VisitCounters whole_counters(automaton->getTable());
+        auto whole = automaton->cursor();
+        whole.feed(input.data(), input.size(), whole_counters.recorder());
+
+        VisitCounters first_counters(automaton->getTable()), second_counters(automaton->getTable());
+        auto first = automaton->cursor();
+        first.feed(input.data(), split, first_counters.recorder());
+        std::stringstream checkpoint;
+        first.save(checkpoint, &first_counters);
+        auto second = automaton->cursor();
+        second.restore(checkpoint, &second_counters);
+        second.feed(input.data() + split, input.size() - split, second_counters.recorder());
+
+        auto expected = whole_counters.profile(), restored = second_counters.profile();
+        check(second.state == whole.state and second.offset == input.size(), "checkpoint state", input);
+        check(restored.states == expected.states and restored.transitions == expected.transitions, "checkpoint counters", input);
+    }
+}
+
+static void test_synth_inputs() {
+    /*
+        dfa_gen --corpus and dfa_bench corpora: for every shape over many
+        seeds the generator terminates, and at least the requested share of
+        inputs is accepted unless f is unreachable from q.
+    */
+
+    for(int seed = 0; seed < 800; seed++) {
+        std::mt19937_64 rng(seed);
+        auto shape = Shape(seed % 4);
+        int alphabet = 2 + seed % 5;
+        auto synth = synth_automaton(shape, 2 + rng() % 12, 1 + rng() % alphabet, alphabet, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        auto &table = automaton->getTable();
+
+        std::vector<uint8_t> reached(table.nstates, 0);
+        std::vector<int32_t> queue {table.q};
+        reached[table.q] = 1;
+        for(size_t head = 0; head < queue.size(); head++) {
+            for(auto symbol = 0; symbol < alphabet; symbol++) {
+                auto next = table.step(queue[head], SYMBOL_BASE + symbol);
+                if(reached[next]) continue;
+                reached[next] = 1;
+                queue.push_back(next);
+            }
+        }
+
+        auto inputs = synth_inputs(table, alphabet, 100, rng() % 20, 0.5, rng);
+        size_t accepted = 0;
+        for(auto &input: inputs) accepted += automaton->execute(input);
+        check(inputs.size() == 100, "synth_inputs count", std::to_string(seed));
+        check(accepted >= 50 or !reached[table.f], "synth_inputs accepted share", std::to_string(seed));
+    }
+}
+
+static void test_result_cache() {
+    /*
+        Cached results equal CompiledDFA::execute for two automata sharing
+        one small cache from several threads, with inputs that differ only
+        in their last byte and inputs too long to be cached.
+    */
+
+    std::mt19937_64 rng(5);
+    auto first = synth_automaton(Shape::Substring, 6, 2, 2, rng);
+    auto second = synth_automaton(Shape::Random, 50, 3, 3, rng);
+    std::vector<CompiledDFAPtr> automata {DFA(first.diagram, first.q, first.f).freeze(), DFA(second.diagram, second.q, second.f).freeze()};
+
+    std::vector<std::string> inputs;
+    for(int i = 0; i < 2000; i++) {
+        auto input = random_input(3, i % 100 == 0 ? 3000 : 60, rng);
+        inputs.push_back(input);
+        input.push_back(char(SYMBOL_BASE + rng() % 3));
+        inputs.push_back(input);
+    }
+
+    ResultCache cache(256);
+    std::atomic<int> wrong {0};
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937_64 local(t);
+            for(int i = 0; i < 50000; i++) {
+                auto &input = inputs[local() % (i % 2 ? 64 : inputs.size())];
+                auto &automaton = *automata[local() % 2];
+                if(cache.execute(automaton, input) != automaton.execute(input)) wrong++;
+            }
+        });
+    }
+    for(auto &thread: threads) thread.join();
+    check(wrong == 0, "ResultCache::execute", std::to_string(wrong.load()) + " wrong results");
+    check(cache.hits() > 0 and cache.hits() + cache.misses() <= 200000, "ResultCache counters", std::to_string(cache.hits()));
+}
+
+static void test_flow_table() {
+    /*
+        FlowTable against a std::map of states stepped with
+        TransitionTable::step: interleaved packets through feed and
+        feedBatch, growth from a tiny table, erase (backward-shift delete
+        keeps every other flow findable), evictIdle and a save/restore
+        round trip into another State type.
+    */
+
+    std::mt19937_64 rng(3);
+    for(int round = 0; round < 40; round++) {
+        auto synth = synth_automaton(Shape(round % 4), 2 + rng() % 60, 3, 3, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        auto &table = automaton->getTable();
+        FlowTable<uint16_t> flows(automaton, 4);
+        std::map<uint64_t, std::pair<int32_t, uint32_t>> expected;
+
+        for(uint32_t now = 0; now < 60; now++) {
+            std::vector<uint64_t> keys;
+            std::vector<std::string> packets;
+            for(int i = 0; i < 50; i++) {
+                keys.push_back(rng() % 300);
+                packets.push_back(random_input(3, 20, rng));
+            }
+            std::vector<Span> spans;
+            for(auto &packet: packets) spans.push_back(Span{packet.data(), packet.size()});
+            std::vector<uint8_t> results(keys.size());
+            if(now % 2) flows.feedBatch(keys.data(), spans.data(), spans.size(), now, results.data());
+            else for(size_t i = 0; i < keys.size(); i++) results[i] = flows.feed(keys[i], spans[i].data, spans[i].size, now);
+
+            for(size_t i = 0; i < keys.size(); i++) {
+                auto found = expected.find(keys[i]);
+                int32_t state = found == expected.end() ? table.q : found->second.first;
+                for(auto c: packets[i]) state = table.step(state, c);
+                expected[keys[i]] = std::make_pair(state, now);
+                check(results[i] == (state == table.f), "FlowTable feed result", packets[i]);
+            }
+
+            for(int i = 0; i < 10; i++) {
+                auto key = rng() % 300;
+                check(flows.erase(key) == bool(expected.erase(key)), "FlowTable erase", std::to_string(key));
+            }
+            if(now % 10 == 9) {
+                size_t evicted = 0;
+                for(auto it = expected.begin(); it != expected.end();) {
+                    if(now - it->second.second > 3) {
+                        it = expected.erase(it);
+                        evicted++;
+                    }
+                    else it++;
+                }
+                check(flows.evictIdle(now, 3) == evicted, "FlowTable evictIdle", std::to_string(now));
+            }
+
+            check(flows.size() == expected.size(), "FlowTable size", std::to_string(now));
+            for(uint64_t key = 0; key < 300; key++) {
+                uint16_t state;
+                auto found = expected.find(key);
+                bool present = flows.find(key, state);
+                check(present == (found != expected.end()), "FlowTable find", std::to_string(key));
+                if(present and found != expected.end()) check(state == found->second.first, "FlowTable state", std::to_string(key));
+            }
+        }
+
+        std::stringstream checkpoint;
+        flows.save(checkpoint);
+        FlowTable<uint32_t> restored(automaton);
+        restored.restore(checkpoint);
+        check(restored.size() == expected.size(), "FlowTable restore size", std::to_string(round));
+        for(auto &entry: expected) {
+            uint32_t state;
+            check(restored.find(entry.first, state) and int32_t(state) == entry.second.first, "FlowTable restore", std::to_string(entry.first));
+        }
+    }
+}
+
+static void test_heatmap() {
+    /*
+        Every byte consumed over an edge is counted on exactly one heatmap
+        entry: the entries match counts of the edges taken while stepping
+        the input, and add up to the visits minus bytes without an edge.
+    */
+
+    std::mt19937_64 rng(13);
+    for(int round = 0; round < 100; round++) {
+        int alphabet = 2 + rng() % 4;
+        auto synth = synth_automaton(Shape(round % 4), 2 + rng() % 20, alphabet, alphabet, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        auto &table = automaton->getTable();
+        auto &diagram = automaton->getStateDiagram();
+
+        VisitCounters counters(table);
+        std::map<std::pair<int, int>, uint64_t> expected;
+        std::map<int, uint64_t> stays;
+        for(int k = 0; k < 20; k++) {
+            auto input = random_input(alphabet, 50, rng);
+            auto cursor = automaton->cursor();
+            cursor.feed(input.data(), input.size(), counters.recorder());
+            int32_t state = table.q;
+            for(auto c: input) {
+                auto next = table.step(state, c);
+                bool edge = false;
+                for(auto pair: diagram.getState(state)) edge = edge or pair.first == c or pair.first == ANY_SYMBOL;
+                if(edge) expected[std::make_pair(state, int(next))]++;
+                else stays[state]++;
+                state = next;
+            }
+        }
+
+        std::ostringstream heatmap;
+        diagram.printHeatmap(counters.profile(), heatmap);
+        std::istringstream lines(heatmap.str());
+        std::string line;
+        std::map<std::pair<int, int>, uint64_t> printed;
+        while(std::getline(lines, line)) {
+            auto fields = split(line, '|');
+            int state = std::stoi(fields[0]);
+            uint64_t visits = std::stoull(fields[0].substr(fields[0].find(':') + 1));
+            uint64_t total = 0;
+            for(size_t e = 1; e < fields.size(); e++) {
+                std::istringstream entry(fields[e]);
+                std::string weights;
+                int y;
+                uint64_t count;
+                entry>>weights>>y>>count;
+                printed[std::make_pair(state, y)] += count;
+                total += count;
+            }
+            check(total + stays[state] == visits, "heatmap entries add up to visits", line);
+        }
+        for(auto &edge: expected) {
+            check(printed[edge.first] == edge.second, "heatmap edge count", std::to_string(edge.first.first) + " -> " + std::to_string(edge.first.second));
+        }
+    }
+}
+
+static void test_thread_pool() {
+    /*
+        Workers of one pool submitting into another, smaller pool: every
+        task runs once, on the pool it was submitted to.
+    */
+
+    ThreadPool outer(8), inner(1);
+    std::atomic<int> outer_runs {0}, inner_runs {0};
+    for(int i = 0; i < 64; i++) {
+        outer.submit([&]() {
+            outer_runs++;
+            inner.submit([&]() { inner_runs++; });
+        });
+    }
+    outer.wait();
+    inner.wait();
+    check(outer_runs == 64 and inner_runs == 64, "ThreadPool nested submit", std::to_string(inner_runs.load()));
+
+    /* Tasks that split themselves stay with their own pool */
+    std::atomic<int> pieces {0};
+    std::function<void(int)> split_task = [&](int depth) {
+        pieces++;
+        if(depth == 0) return;
+        outer.submit([&, depth]() { split_task(depth - 1); });
+        outer.submit([&, depth]() { split_task(depth - 1); });
+    };
+    outer.submit([&]() { split_task(8); });
+    outer.wait();
+    check(pieces == 511, "ThreadPool recursive submit", std::to_string(pieces.load()));
+}
+
+static void test_tokenizer() {
+    /*
+        Tokenizer::tokenize against maximal munch by brute force (longest
+        accepted prefix from every token start, UNMATCHED runs merged),
+        with several accepting states, also when resumed after a small
+        token buffer fills up.
+    */
+
+    std::mt19937_64 rng(17);
+    for(int round = 0; round < 200; round++) {
+        int alphabet = 2 + rng() % 3;
+        auto synth = synth_automaton(Shape(round % 4), 2 + rng() % 20, alphabet, alphabet, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        auto &table = automaton->getTable();
+        std::vector<int32_t> types(table.nstates, -1);
+        for(auto state = 0; state < table.nstates; state++) {
+            if(state == table.f or rng() % 4 == 0) types[state] = int32_t(rng() % 3);
+        }
+        Tokenizer tokenizer(automaton, types);
+
+        for(int k = 0; k < 20; k++) {
+            auto input = random_input(alphabet, 60, rng);
+            std::vector<Token> expected;
+            for(size_t pos = 0; pos < input.size();) {
+                int32_t state = table.q;
+                size_t best = 0;
+                int32_t type = -1;
+                for(auto i = pos; i < input.size(); i++) {
+                    state = table.step(state, input[i]);
+                    if(types[state] >= 0) {
+                        best = i + 1 - pos;
+                        type = types[state];
+                    }
+                }
+                if(best == 0) {
+                    if(!expected.empty() and expected.back().type == Token::UNMATCHED) expected.back().length++;
+                    else expected.push_back(Token{Token::UNMATCHED, 1, pos});
+                    pos++;
+                    continue;
+                }
+                expected.push_back(Token{uint32_t(type), uint32_t(best), pos});
+                pos += best;
+            }
+
+            for(size_t capacity: {size_t(64), size_t(1), size_t(2)}) {
+                std::vector<Token> tokens(capacity), got;
+                size_t at = 0;
+                for(int calls = 0; at < input.size() and calls < 200; calls++) {
+                    size_t consumed = 0;
+                    auto count = tokenizer.tokenize(input.data() + at, input.size() - at, tokens.data(), capacity, consumed, at);
+                    got.insert(got.end(), tokens.begin(), tokens.begin() + count);
+                    at += consumed;
+                }
+                /* A resumed call may split an UNMATCHED run; merge it back */
+                std::vector<Token> merged;
+                for(auto &token: got) {
+                    if(!merged.empty() and token.type == Token::UNMATCHED and merged.back().type == Token::UNMATCHED) merged.back().length += token.length;
+                    else merged.push_back(token);
+                }
+                bool same = at == input.size() and merged.size() == expected.size();
+                for(size_t i = 0; same and i < merged.size(); i++) {
+                    same = merged[i].type == expected[i].type and merged[i].length == expected[i].length and merged[i].offset == expected[i].offset;
+                }
+                check(same, "Tokenizer::tokenize", input + " capacity " + std::to_string(capacity));
+            }
+        }
+    }
+}
+
+static void test_parser() {
+    /*
+        build_dfa_from_file against the diagram it was written from: the
+        compiled tables match, with one thread and with a file large enough
+        to be split into chunks parsed in parallel and merged through the
+        CSR builder. Errors in any chunk and missing header lines throw.
+    */
+
+    std::mt19937_64 rng(23);
+    std::string path = "/tmp/dfa_test_parse_" + std::to_string(getpid()) + ".gph";
+    auto fingerprint = [](const SynthAutomaton& synth) {
+        return TransitionTable(synth.diagram, synth.q, synth.f).fingerprint;
+    };
+
+    for(int round = 0; round < 100; round++) {
+        int alphabet = 2 + rng() % 8;
+        auto synth = synth_automaton(Shape(round % 4), 2 + rng() % 50, 1 + rng() % alphabet, alphabet, rng);
+        write_gph(path, synth.diagram, synth.q, synth.f);
+        auto parsed = build_dfa_from_file(path);
+        check(parsed.compile().fingerprint == fingerprint(synth), "parse", std::to_string(round));
+    }
+
+    /* About 4 * MIN_CHUNK_BYTES of adjacency lists */
+    auto large = synth_automaton(Shape::Random, 400000, 4, 4, rng);
+    write_gph(path, large.diagram, large.q, large.f);
+    for(size_t nthreads: {size_t(1), size_t(3), size_t(8)}) {
+        auto parsed = build_dfa_from_file(path, nthreads);
+        check(parsed.compile().fingerprint == fingerprint(large), "parallel parse", std::to_string(nthreads) + " threads");
+    }
+
+    {
+        std::ofstream out(path, std::ios::app);
+        out<<"7: 48 x\n";
+    }
+    bool thrown = false;
+    try {
+        build_dfa_from_file(path, 4);
+    }
+    catch(const std::invalid_argument&) {
+        thrown = true;
+    }
+    check(thrown, "parse error in the last chunk", path);
+
+    for(auto text: {"", "1\n", "1\n-2\n1: 48 1\n"}) {
+        {
+            std::ofstream out(path, std::ios::trunc);
+            out<<text;
+        }
+        thrown = false;
+        try {
+            build_dfa_from_file(path);
+        }
+        catch(const std::exception&) {
+            thrown = true;
+        }
+        check(thrown, "bad header", text);
+    }
+    std::remove(path.c_str());
+}
+
+static void test_csr_builder() {
+    /*
+        StateDiagramBuilder: the same edges inserted in any order, or spread
+        over several EdgeBuffers as the parser threads hand them over, give
+        the same table; DFA::execute over the CSR adjacency lists agrees
+        with the compiled table.
+    */
+
+    std::mt19937_64 rng(29);
+    for(int round = 0; round < 200; round++) {
+        int nstates = 2 + rng() % 30;
+        std::vector<EdgeRecord> edges;
+        for(int state = 1; state <= nstates; state++) {
+            std::vector<int> weights {ANY_SYMBOL};
+            for(int byte = -128; byte < 128; byte++) weights.push_back(byte);
+            std::shuffle(weights.begin(), weights.end(), rng);
+            weights.resize(rng() % 6);
+            for(auto weight: weights) edges.push_back(EdgeRecord{state, weight, 1 + int(rng() % nstates)});
+        }
+
+        StateDiagramBuilder ordered;
+        for(auto &edge: edges) ordered.insertEdge(edge.state, edge.weight, edge.y);
+        for(int state = 1; state <= nstates; state++) ordered.addVertex();
+        DFA reference(ordered.finalize(), 1, nstates);
+
+        std::shuffle(edges.begin(), edges.end(), rng);
+        std::vector<EdgeBuffer> parts(1 + rng() % 4);
+        for(auto &edge: edges) parts[rng() % parts.size()].edges.push_back(edge);
+        parts[0].nvertices = nstates;
+        auto shuffled = DFA(StateDiagramBuilder(std::move(parts)).finalize(), 1, nstates).freeze();
+        check(shuffled->getTable().fingerprint == reference.compile().fingerprint, "CSR builder order", std::to_string(round));
+
+        for(int k = 0; k < 20; k++) {
+            std::string input;
+            auto length = rng() % 30;
+            for(size_t i = 0; i < length; i++) input += char(rng() % 2 ? SYMBOL_BASE + rng() % 4 : rng() % 256);
+            check(reference.execute(input) == shuffled->execute(input), "CSR DFA::execute", std::to_string(round));
+        }
+    }
+}
+
+static void test_aho_corasick() {
+    /*
+        AhoCorasick against brute-force substring search: findAll reports
+        every (keyword id, end offset), longest first per end, also when the
+        text is fed in two pieces; acceptId names the longest keyword ending
+        at every position; the stop_at_first automaton accepts exactly the
+        texts containing a keyword.
+    */
+
+    std::mt19937_64 rng(31);
+    for(int round = 0; round < 200; round++) {
+        int alphabet = 2 + rng() % 3;
+        AhoCorasickBuilder builder;
+        std::vector<std::string> keywords;
+        for(int k = 0; k < 1 + int(rng() % 8); k++) {
+            auto keyword = random_input(alphabet, 5, rng);
+            if(keyword.empty()) continue;
+            auto id = builder.addKeyword(keyword);
+            if(id == keywords.size()) keywords.push_back(keyword);
+            check(keywords[id] == keyword, "AhoCorasick keyword id", keyword);
+        }
+        if(keywords.empty()) continue;
+        auto matcher = builder.build();
+        auto first = builder.build(true);
+        auto &table = matcher.getAutomaton()->getTable();
+
+        for(int t = 0; t < 20; t++) {
+            auto text = random_input(alphabet, 60, rng);
+            std::vector<std::pair<uint32_t, size_t>> expected;
+            bool contains = false;
+            int32_t state = table.q;
+            for(size_t end = 1; end <= text.size(); end++) {
+                std::vector<uint32_t> here;
+                for(uint32_t id = 0; id < keywords.size(); id++) {
+                    auto &keyword = keywords[id];
+                    if(keyword.size() <= end and text.compare(end - keyword.size(), keyword.size(), keyword) == 0) here.push_back(id);
+                }
+                std::sort(here.begin(), here.end(), [&](uint32_t a, uint32_t b) { return keywords[a].size() > keywords[b].size(); });
+                for(auto id: here) expected.emplace_back(id, end);
+                contains = contains or !here.empty();
+
+                state = table.step(state, text[end - 1]);
+                check(matcher.acceptId(state) == (here.empty() ? -1 : int32_t(here[0])), "AhoCorasick acceptId", text.substr(0, end));
+            }
+
+            std::vector<std::pair<uint32_t, size_t>> found;
+            auto cursor = matcher.getAutomaton()->cursor();
+            auto split = rng() % (text.size() + 1);
+            auto record = [&](uint32_t id, size_t end) { found.emplace_back(id, end); };
+            matcher.findAll(cursor, text.data(), split, record);
+            matcher.findAll(cursor, text.data() + split, text.size() - split, record);
+            check(found == expected, "AhoCorasick findAll", text);
+            check(first.getAutomaton()->execute(text) == contains, "AhoCorasick stop_at_first", text);
+        }
+    }
+}
+
+static void test_stride_table() {
+    /*
+        A Cursor with a StrideTable ends every feed in the state
+        TransitionTable::step reaches, for pieces of odd and even length.
+    */
+
+    std::mt19937_64 rng(43);
+    for(int round = 0; round < 200; round++) {
+        auto shape = Shape(round % 4);
+        int alphabet = 2 + rng() % 3;
+        auto synth = synth_automaton(shape, 2 + rng() % 40, alphabet, alphabet, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        auto &table = automaton->getTable();
+        StrideTable stride(table);
+
+        for(int t = 0; t < 30; t++) {
+            auto input = random_input(alphabet, 100, rng);
+            Cursor cursor(table, &stride);
+            int32_t expected = table.q;
+            size_t i = 0;
+            while(i < input.size()) {
+                auto piece = std::min<size_t>(input.size() - i, rng() % 8);
+                cursor.feed(input.data() + i, piece);
+                for(auto end = i + piece; i < end; i++) expected = table.step(expected, input[i]);
+                check(cursor.state == expected and cursor.offset == i, "StrideTable feed", input.substr(0, i));
+            }
+            check(cursor.accepted() == automaton->execute(input), "StrideTable accepted", input);
+        }
+    }
+}
+
+static void test_bit_table() {
+    /*
+        feedBits over packed bits, in either bit order and in whole-byte
+        pieces with a ragged last one, reaches the state TransitionTable::step
+        reaches on the matching '0'/'1' string.
+    */
+
+    std::mt19937_64 rng(44);
+    for(int round = 0; round < 200; round++) {
+        auto shape = Shape(round % 4);
+        auto synth = synth_automaton(shape, 2 + rng() % 40, 2, 2, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        auto &table = automaton->getTable();
+        bool msb = round % 2;
+        BitTable bits(table, '0', '1', msb);
+
+        for(int t = 0; t < 30; t++) {
+            auto input = random_input(2, 200, rng);
+            std::vector<uint8_t> packed((input.size() + 7) / 8);
+            for(size_t i = 0; i < input.size(); i++) {
+                if(input[i] == '1') packed[i / 8] |= uint8_t(msb ? 0x80 >> (i % 8) : 1 << (i % 8));
+            }
+
+            Cursor cursor(table);
+            int32_t expected = table.q;
+            size_t i = 0;
+            while(i < input.size()) {
+                auto piece = std::min<size_t>(input.size() - i, 8 * (rng() % 4));
+                if(rng() % 4 == 0) piece = input.size() - i;
+                cursor.feedBits(bits, packed.data() + i / 8, piece);
+                for(auto end = i + piece; i < end; i++) expected = table.step(expected, input[i]);
+                check(cursor.state == expected and cursor.offset == i, "BitTable feedBits", input.substr(0, i));
+            }
+            check(cursor.accepted() == automaton->execute(input), "BitTable accepted", input);
+        }
+    }
+}
+
+static void test_state_map() {
+    /*
+        StateMap::of gives, from every start state, the state
+        TransitionTable::step reaches; then() of the pieces of a string, in
+        any grouping and with identity() anywhere, is the map of the whole
+        string. compose() is checked on its own for lengths that exercise
+        both the gather loop and its tail.
+    */
+
+    std::mt19937_64 rng(45);
+    for(int round = 0; round < 200; round++) {
+        auto shape = Shape(round % 4);
+        int alphabet = 2 + rng() % 3;
+        auto synth = synth_automaton(shape, 2 + rng() % 40, alphabet, alphabet, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        auto &table = automaton->getTable();
+        auto identity = StateMap::identity(table.nstates);
+
+        for(int t = 0; t < 20; t++) {
+            auto input = random_input(alphabet, 100, rng);
+            auto whole = StateMap::of(table, input.data(), input.size());
+            for(int32_t start = 0; start < table.nstates; start++) {
+                int32_t expected = start;
+                for(auto c: input) expected = table.step(expected, c);
+                check(whole[start] == expected, "StateMap::of", input);
+            }
+            check(automaton->execute(input) == (whole[table.q] == table.f), "StateMap accepts", input);
+
+            auto cut1 = rng() % (input.size() + 1), cut2 = rng() % (input.size() + 1);
+            if(cut1 > cut2) std::swap(cut1, cut2);
+            auto a = StateMap::of(table, input.data(), cut1);
+            auto b = StateMap::of(table, input.data() + cut1, cut2 - cut1);
+            auto c = StateMap::of(table, input.data() + cut2, input.size() - cut2);
+            check(a.then(b).then(c) == whole, "StateMap left grouping", input);
+            check(a.then(b.then(c)) == whole, "StateMap right grouping", input);
+            check(identity.then(a).then(identity).then(b.then(identity)).then(c) == whole, "StateMap identity", input);
+        }
+    }
+
+    for(size_t n = 1; n < 40; n++) {
+        std::vector<int32_t> first(n), second(n), out(n);
+        for(auto &s: first) s = int32_t(rng() % n);
+        for(auto &s: second) s = int32_t(rng() % n);
+        StateMap::compose(first.data(), second.data(), out.data(), n);
+        bool ok = true;
+        for(size_t s = 0; s < n; s++) ok = ok and out[s] == second[first[s]];
+        StateMap::compose(first.data(), second.data(), first.data(), n);
+        check(ok and first == out, "StateMap::compose", std::to_string(n));
+    }
+}
+
+static void test_state_map_tree() {
+    /*
+        StateMapTree after random replace/insert/erase, with small chunks so
+        edits cross and re-chunk many of them, against the edited string
+        re-executed with TransitionTable::step: whole-text acceptance, and
+        run/accepts over random ranges.
+    */
+
+    std::mt19937_64 rng(46);
+    for(int round = 0; round < 100; round++) {
+        auto shape = Shape(round % 4);
+        int alphabet = 2 + rng() % 3;
+        auto synth = synth_automaton(shape, 2 + rng() % 40, alphabet, alphabet, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        auto &table = automaton->getTable();
+
+        auto expected = random_input(alphabet, 200, rng);
+        StateMapTree tree(automaton, expected, 1 + rng() % 8);
+        for(int edit = 0; edit < 60; edit++) {
+            auto pos = rng() % (expected.size() + 1);
+            auto count = std::min<size_t>(expected.size() - pos, rng() % 20);
+            auto text = random_input(alphabet, 20, rng);
+            switch(rng() % 4) {
+            case 0: tree.insert(pos, text); expected.insert(pos, text); break;
+            case 1: tree.erase(pos, count); expected.erase(pos, count); break;
+            case 2: tree.erase(0, expected.size()); expected.clear(); break;
+            default: tree.replace(pos, count, text); expected.replace(pos, count, text); break;
+            }
+
+            check(tree.size() == expected.size() and tree.text() == expected, "StateMapTree text", expected);
+            check(tree.accepted() == forward_accepts(table, expected, 0, expected.size()), "StateMapTree accepted", expected);
+            for(int q = 0; q < 5; q++) {
+                auto begin = rng() % (expected.size() + 1), end = rng() % (expected.size() + 1);
+                if(begin > end) std::swap(begin, end);
+                check(tree.accepts(begin, end) == forward_accepts(table, expected, begin, end), "StateMapTree accepts", expected.substr(begin, end - begin));
+                int32_t start = int32_t(rng() % table.nstates), state = start;
+                for(auto i = begin; i < end; i++) state = table.step(state, expected[i]);
+                check(tree.run(begin, end, start) == state, "StateMapTree run", expected.substr(begin, end - begin));
+            }
+        }
+
+        bool thrown = false;
+        try { tree.replace(expected.size(), 1, "0"); } catch(const std::out_of_range&) { thrown = true; }
+        check(thrown, "StateMapTree range check", expected);
+    }
+}
+
+static void test_execute_batch_shared() {
+    /*
+        execute_batch_shared agrees with execute_batch on batches full of
+        shared prefixes, duplicates, prefixes of each other and the empty
+        input, including bytes outside the alphabet on either side of 0x80.
+    */
+
+    std::mt19937_64 rng(47);
+    for(int round = 0; round < 200; round++) {
+        auto shape = Shape(round % 4);
+        int alphabet = 2 + rng() % 3;
+        auto synth = synth_automaton(shape, 2 + rng() % 40, alphabet, alphabet, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        auto &table = automaton->getTable();
+
+        std::vector<std::string> inputs {""};
+        for(int i = 0; i < 200; i++) {
+            std::string input;
+            if(rng() % 4) {
+                auto &base = inputs[rng() % inputs.size()];
+                input = base.substr(0, rng() % (base.size() + 1));
+            }
+            input += random_input(alphabet, 30, rng);
+            if(rng() % 8 == 0) input.insert(rng() % (input.size() + 1), 1, char(rng() % 2 ? 0x7f : 0xfe));
+            inputs.push_back(input);
+        }
+        std::vector<Span> spans;
+        for(auto &input: inputs) spans.push_back(Span{input.data(), input.size()});
+        std::vector<uint8_t> expected(inputs.size()), results(inputs.size(), 2);
+        execute_batch(table, spans.data(), spans.size(), expected.data());
+        execute_batch_shared(table, spans.data(), spans.size(), results.data());
+
+        for(size_t i = 0; i < inputs.size(); i++) check(results[i] == expected[i], "execute_batch_shared", inputs[i]);
+    }
+}
+
+static void test_scan_cli() {
+    /*
+        dfa_bin --scan, through mmap and through --uring on alternate
+        rounds, over a directory tree, files given directly, an empty file
+        and a missing one: one `<path>: True|False` line per file that
+        agrees with CompiledDFA::execute on its contents, an error line and
+        exit status 1 for the missing file.
+    */
+
+    char scratch[] = "/tmp/dfa_test.XXXXXX";
+    if(!mkdtemp(scratch)) {
+        check(false, "--scan", "mkdtemp failed");
+        return;
+    }
+    std::string dir = scratch;
+
+    std::mt19937_64 rng(27);
+    for(int round = 0; round < 8; round++) {
+        auto shape = Shape(round % 4);
+        int alphabet = 2 + rng() % 3;
+        auto synth = synth_automaton(shape, 2 + rng() % 40, alphabet, alphabet, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        write_gph(dir + "/dfa.gph", synth.diagram, synth.q, synth.f);
+
+        auto tree = dir + "/tree" + std::to_string(round);
+        std::system(("mkdir -p " + tree + "/sub/deeper").c_str());
+        std::map<std::string, bool> expected;
+        std::string paths;
+        for(int i = 0; i < 40; i++) {
+            auto path = tree + (i % 3 == 0 ? "/sub" : i % 3 == 1 ? "/sub/deeper" : "") + "/f" + std::to_string(i);
+            auto content = i == 0 ? std::string() : random_input(alphabet, i % 5 == 0 ? 100000 : 200, rng);
+            write_file(path, content);
+            expected[path] = automaton->execute(content);
+            if(i % 3 == 2) paths += " " + path;
+        }
+        expected[tree + "/missing"] = false;
+
+        std::string output;
+        auto status = run_command(std::string("./dfa_bin --scan ") + (round % 2 ? "--uring " : "") + dir + "/dfa.gph " + tree + "/sub" + paths + " " + tree + "/missing", output);
+        check(status == 1, "--scan status", std::to_string(status));
+
+        std::istringstream lines(output);
+        std::string line;
+        size_t seen = 0;
+        while(std::getline(lines, line)) {
+            auto colon = line.find(": ");
+            auto path = line.substr(0, colon);
+            auto verdict = colon == std::string::npos ? "" : line.substr(colon + 2);
+            auto want = expected.find(path);
+            if(path == tree + "/missing") check(verdict.compare(0, 6, "Error:") == 0, "--scan missing file", line);
+            else check(want != expected.end() and verdict == (want->second ? "True" : "False"), "--scan result", line);
+            seen++;
+        }
+        check(seen == expected.size(), "--scan line count", std::to_string(seen));
+    }
+
+    std::system(("rm -rf " + dir).c_str());
+}
+
+static void test_lines_cli() {
+    /*
+        dfa_bin --lines from a file and from stdin, plain, --profile and
+        --watch, against CompiledDFA::execute per line: accepted lines in
+        input order (or, with --count, their number), with empty lines, an
+        unterminated last line and inputs spanning several read blocks.
+    */
+
+    char scratch[] = "/tmp/dfa_test.XXXXXX";
+    if(!mkdtemp(scratch)) {
+        check(false, "--lines", "mkdtemp failed");
+        return;
+    }
+    std::string dir = scratch;
+
+    std::mt19937_64 rng(28);
+    for(int round = 0; round < 12; round++) {
+        auto shape = Shape(round % 4);
+        int alphabet = 2 + rng() % 3;
+        auto synth = synth_automaton(shape, 2 + rng() % 40, alphabet, alphabet, rng);
+        auto automaton = DFA(synth.diagram, synth.q, synth.f).freeze();
+        write_gph(dir + "/dfa.gph", synth.diagram, synth.q, synth.f);
+
+        /* Every fourth round is larger than two LINE_BLOCK_BYTES blocks */
+        size_t nlines = round % 4 == 3 ? 300000 : 1 + rng() % 2000;
+        std::string input, expected;
+        size_t accepted = 0;
+        for(size_t i = 0; i < nlines; i++) {
+            auto line = random_input(alphabet, rng() % 8 == 0 ? 0 : 80, rng);
+            input += line;
+            if(i + 1 < nlines or rng() % 2) input += '\n';
+            if(automaton->execute(line)) {
+                expected += line + "\n";
+                accepted++;
+            }
+        }
+        write_file(dir + "/input.txt", input);
+
+        std::string flags = round % 3 == 0 ? "" : round % 3 == 1 ? "--profile " : "--watch ";
+        auto command = "./dfa_bin --lines " + flags + dir + "/dfa.gph";
+        std::string output;
+        auto status = run_command(command + " " + dir + "/input.txt 2>/dev/null", output);
+        check(status == 0 and output == expected, "--lines from file", flags + std::to_string(nlines));
+        status = run_command(command + " < " + dir + "/input.txt 2>/dev/null", output);
+        check(status == 0 and output == expected, "--lines from stdin", flags + std::to_string(nlines));
+        status = run_command("./dfa_bin --lines --count " + flags + dir + "/dfa.gph - < " + dir + "/input.txt 2>/dev/null", output);
+        check(status == 0 and output == std::to_string(accepted) + "\n", "--lines --count", output);
+    }
+
+    std::system(("rm -rf " + dir).c_str());
+}
+
+static void append_u32(std::string& out, uint32_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static bool recv_exact(int fd, char* data, size_t length) {
+    while(length > 0) {
+        auto got = recv(fd, data, length, 0);
+        if(got <= 0) return false;
+        data += got;
+        length -= size_t(got);
+    }
+    return true;
+}
+
+static void test_serve_cli() {
+    /*
+        dfa_bin --serve, with and without --cache, over two DFAs: pipelined
+        requests (one burst large enough that the server has to stop
+        reading until the client catches up) are answered in order with the
+        results of CompiledDFA::execute on the indexed DFA; a bad index and
+        a malformed body get status 1 without closing the connection.
+    */
+
+    char scratch[] = "/tmp/dfa_test.XXXXXX";
+    if(!mkdtemp(scratch)) {
+        check(false, "--serve", "mkdtemp failed");
+        return;
+    }
+    std::string dir = scratch;
+    auto socket_path = dir + "/serve.sock";
+
+    std::mt19937_64 rng(37);
+    for(int round = 0; round < 2; round++) {
+        std::vector<CompiledDFAPtr> automata;
+        for(int k = 0; k < 2; k++) {
+            auto synth = synth_automaton(Shape(rng() % 4), 2 + rng() % 40, 3, 3, rng);
+            automata.push_back(DFA(synth.diagram, synth.q, synth.f).freeze());
+            write_gph(dir + "/dfa" + std::to_string(k) + ".gph", synth.diagram, synth.q, synth.f);
+        }
+
+        auto pid = fork();
+        if(pid == 0) {
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, 2);
+            auto dfa0 = dir + "/dfa0.gph", dfa1 = dir + "/dfa1.gph";
+            if(round == 0) execl("./dfa_bin", "dfa_bin", "--serve", socket_path.c_str(), dfa0.c_str(), dfa1.c_str(), (char*)nullptr);
+            else execl("./dfa_bin", "dfa_bin", "--serve", "--cache", "1000", socket_path.c_str(), dfa0.c_str(), dfa1.c_str(), (char*)nullptr);
+            _exit(127);
+        }
+
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, socket_path.data(), socket_path.size());
+        int fd = -1;
+        for(int attempt = 0; attempt < 500 and fd < 0; attempt++) {
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+                close(fd);
+                fd = -1;
+                usleep(10000);
+            }
+        }
+        check(fd >= 0, "--serve connect", socket_path);
+
+        /* Requests: a batch per DFA, errors in between, then a burst of ~5 MB of answers */
+        std::string requests;
+        std::vector<std::pair<uint8_t, std::string>> answers;
+        auto request = [&](uint32_t index, const std::vector<std::string>& inputs) {
+            std::string body;
+            append_u32(body, index);
+            append_u32(body, uint32_t(inputs.size()));
+            std::string results;
+            for(auto &input: inputs) {
+                append_u32(body, uint32_t(input.size()));
+                body += input;
+                if(index < automata.size()) results.push_back(char(automata[index]->execute(input)));
+            }
+            append_u32(requests, uint32_t(body.size()));
+            requests += body;
+            answers.emplace_back(index < automata.size() ? 0 : 1, results);
+        };
+
+        for(int batch = 0; batch < 20; batch++) {
+            std::vector<std::string> inputs;
+            for(int i = 0; i < 100; i++) inputs.push_back(random_input(3, i % 10 == 0 ? 2000 : 40, rng));
+            request(uint32_t(batch % 2), inputs);
+            if(batch == 5) request(2, inputs);
+        }
+        for(uint32_t count: {2, 0}) {
+            /* Count 2 with one truncated input, count 0 with trailing bytes */
+            std::string malformed;
+            append_u32(malformed, 0);
+            append_u32(malformed, count);
+            append_u32(malformed, 100);
+            append_u32(requests, uint32_t(malformed.size()));
+            requests += malformed;
+            answers.emplace_back(1, "");
+        }
+        for(int batch = 0; batch < 20; batch++) {
+            std::vector<std::string> inputs(250000);
+            for(auto &input: inputs) input = random_input(3, 4, rng);
+            request(uint32_t(batch % 2), inputs);
+        }
+
+        std::thread writer([&] {
+            for(size_t at = 0; fd >= 0 and at < requests.size();) {
+                auto sent = send(fd, requests.data() + at, requests.size() - at, MSG_NOSIGNAL);
+                if(sent <= 0) break;
+                at += size_t(sent);
+            }
+        });
+        for(size_t k = 0; fd >= 0 and k < answers.size(); k++) {
+            char header[8];
+            if(!recv_exact(fd, header, sizeof(header))) {
+                check(false, "--serve response", "connection closed at " + std::to_string(k));
+                break;
+            }
+            uint32_t length, status;
+            memcpy(&length, header, 4);
+            memcpy(&status, header + 4, 4);
+            std::string body(length - 4, '\0');
+            if(!recv_exact(fd, &body[0], body.size())) {
+                check(false, "--serve response", "truncated at " + std::to_string(k));
+                break;
+            }
+            check(status == answers[k].first, "--serve status", std::to_string(k) + ": " + body.substr(0, 80));
+            if(status == 0) check(body == answers[k].second, "--serve results", std::to_string(k));
+        }
+        writer.join();
+        if(fd >= 0) close(fd);
+
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+
+    std::system(("rm -rf " + dir).c_str());
+}
+
+int main() {
+    test_find_span();
+    test_prefilter();
+    test_utf8();
+    test_checkpoint();
+    test_synth_inputs();
+    test_result_cache();
+    test_flow_table();
+    test_heatmap();
+    test_thread_pool();
+    test_tokenizer();
+    test_parser();
+    test_csr_builder();
+    test_aho_corasick();
+    test_stride_table();
+    test_bit_table();
+    test_state_map();
+    test_state_map_tree();
+    test_execute_batch_shared();
+    test_scan_cli();
+    test_lines_cli();
+    test_serve_cli();
+
+    if(failures > 0) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}